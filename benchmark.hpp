@@ -0,0 +1,125 @@
+// Shared helpers for the "--bench" modes of the arithmetic examples: a random
+// expression generator and a timing loop which prints RESULT lines.
+//
+// The RESULT lines contain key=value pairs and can be processed by scripts or
+// e.g. sqlplot-tools. Compile with optimization for meaningful numbers, "make
+// bench" builds optimized binaries and runs all benchmarks.
+//
+// Allocations are counted by parse_stats.cpp, which must be linked into the
+// program.
+
+#ifndef BENCHMARK_HEADER
+#define BENCHMARK_HEADER
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <sys/resource.h>
+
+#include "parse_stats.hpp"
+
+/******************************************************************************/
+
+// peak resident set size of the process in KiB. It never decreases, hence it
+// is reported once per process, not per benchmark run.
+inline long PeakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/******************************************************************************/
+
+// Generate an arithmetic expression with the given number of terms, each a
+// single digit, joined by + and *. Parenthesized sub-expressions are nested up
+// to depth levels, and if variables is set some terms are the variable "x".
+inline std::string GenerateExpression(
+    std::mt19937& rng, size_t terms, size_t depth, bool variables = false)
+{
+    std::string out;
+    for (size_t i = 0; i < terms; ++i) {
+        if (i != 0)
+            out += (rng() % 2 ? " + " : " * ");
+        if (depth > 0 && terms > 4 && rng() % 8 == 0) {
+            size_t sub = 2 + rng() % 4;
+            out += "(" + GenerateExpression(rng, sub, depth - 1, variables) + ")";
+        }
+        else if (variables && rng() % 4 == 0) {
+            out += "x";
+        }
+        else {
+            out += std::to_string(rng() % 10);
+        }
+    }
+    return out;
+}
+
+// Run the function reps times on the input and print a RESULT line. The
+// function returns a value which is summed up as checksum to verify that
+// all variants calculate the same results.
+template <typename Function>
+void RunBenchmark(const std::string& benchmark, const std::string& variant,
+                  const std::string& input, size_t terms, size_t depth,
+                  size_t reps, Function function)
+{
+    double checksum = 0;
+
+    // tokens are single characters in the generated expressions
+    size_t tokens = std::count_if(
+        input.begin(), input.end(), [](char c) { return c != ' '; });
+
+    size_t allocs = g_alloc_count, alloc_bytes = g_alloc_bytes;
+    auto t1 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r)
+        checksum += function(input);
+    auto t2 = std::chrono::steady_clock::now();
+    allocs = g_alloc_count - allocs, alloc_bytes = g_alloc_bytes - alloc_bytes;
+
+    double secs = std::chrono::duration<double>(t2 - t1).count();
+    std::cout << "RESULT"
+              << " benchmark=" << benchmark
+              << " variant=" << variant
+              << " terms=" << terms
+              << " depth=" << depth
+              << " bytes=" << input.size()
+              << " tokens=" << tokens
+              << " reps=" << reps
+              << " time=" << secs
+              << " parses_per_s=" << reps / secs
+              << " ns_per_term=" << secs * 1e9 / (reps * terms)
+              << " ns_per_token=" << secs * 1e9 / (reps * tokens)
+              << " allocs_per_parse=" << static_cast<double>(allocs) / reps
+              << " alloc_bytes_per_parse="
+              << static_cast<double>(alloc_bytes) / reps
+              << " checksum=" << checksum
+              << std::endl;
+}
+
+// Call bench(input, terms, depth, reps) for expressions of increasing size,
+// then print the peak RSS of the program in a last RESULT line.
+template <typename Bench>
+void RunExpressionBenchmarks(const char* program, Bench bench,
+                             bool variables = false)
+{
+    std::mt19937 rng(42);
+    for (size_t depth : { 0, 2 }) {
+        for (size_t terms = 10; terms <= 10000; terms *= 10) {
+            std::string input = GenerateExpression(rng, terms, depth, variables);
+            size_t reps = std::max<size_t>(1, 200000 / terms);
+            bench(input, terms, depth, reps);
+        }
+    }
+    std::cout << "RESULT"
+              << " benchmark=peak_rss"
+              << " program=" << program
+              << " peak_rss_kib=" << PeakRSS()
+              << std::endl;
+}
+
+/******************************************************************************/
+
+#endif // !BENCHMARK_HEADER
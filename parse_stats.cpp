@@ -0,0 +1,40 @@
+// Counts the heap allocations of the process for parse_stats.hpp by replacing
+// the global operator new and delete. Link this file into each program which
+// includes parse_stats.hpp, the replacements must only be defined once.
+
+#include "parse_stats.hpp"
+
+#include <new>
+
+/******************************************************************************/
+
+// relaxed atomics: the counters are only read as totals, the increments need
+// not be ordered with anything else.
+std::atomic<size_t> g_alloc_count(0), g_alloc_bytes(0);
+
+// The replacements are not inlined, which would make gcc warn about free()
+// being called on memory from operator new.
+
+__attribute__((noinline))
+void* operator new (size_t size)
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline))
+void operator delete (void* p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete (void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+/******************************************************************************/
@@ -0,0 +1,84 @@
+// Opt-in instrumentation of the parse drivers ParseOrDie(), PhraseParseOrDie()
+// and parse_markup(): count the heap allocations and bytes allocated during a
+// parse, and report them alongside the wall time.
+//
+// Allocations are counted by the global operator new and delete replaced in
+// parse_stats.cpp, which must be linked into each program using this header.
+// Reports are enabled by setting the environment variable PARSE_STATS, e.g.
+// "PARSE_STATS=1 ./spirit6_ast", and are printed to stderr as RESULT lines.
+
+#ifndef PARSE_STATS_HEADER
+#define PARSE_STATS_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+/******************************************************************************/
+// Heap allocations and bytes allocated by all threads of the process, counted
+// by the replaced operator new in parse_stats.cpp.
+
+extern std::atomic<size_t> g_alloc_count, g_alloc_bytes;
+
+/******************************************************************************/
+
+// are reports enabled by the environment variable PARSE_STATS?
+inline bool ParseStatsEnabled()
+{
+    static const bool enabled = (std::getenv("PARSE_STATS") != nullptr);
+    return enabled;
+}
+
+// allocation counts and wall time of a parse
+struct ParseStats
+{
+    size_t allocs = 0, alloc_bytes = 0;
+    double seconds = 0;
+};
+
+// Measures the allocations and time during its lifetime, and prints a report
+// when destroyed if PARSE_STATS is set. Put one at the top of a parse driver.
+// The counters are process-wide, hence allocations of worker threads which a
+// driver starts and joins within the scope are included, but so are those of
+// unrelated threads running at the same time.
+class ParseStatsScope
+{
+public:
+    ParseStatsScope(const char* driver, size_t input_size)
+        : driver_(driver), input_size_(input_size),
+          allocs_(g_alloc_count), alloc_bytes_(g_alloc_bytes),
+          start_(std::chrono::steady_clock::now()) { }
+
+    // the statistics so far
+    ParseStats get() const {
+        ParseStats s;
+        s.allocs = g_alloc_count - allocs_;
+        s.alloc_bytes = g_alloc_bytes - alloc_bytes_;
+        s.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_).count();
+        return s;
+    }
+
+    ~ParseStatsScope() {
+        if (!ParseStatsEnabled()) return;
+        ParseStats s = get();
+        std::cerr << "RESULT"
+                  << " driver=" << driver_
+                  << " input_bytes=" << input_size_
+                  << " allocs=" << s.allocs
+                  << " alloc_bytes=" << s.alloc_bytes
+                  << " time=" << s.seconds
+                  << std::endl;
+    }
+
+private:
+    const char* driver_;
+    size_t input_size_;
+    size_t allocs_, alloc_bytes_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/******************************************************************************/
+
+#endif // !PARSE_STATS_HEADER
@@ -0,0 +1,211 @@
+// Per-rule profiling of Boost Spirit Qi grammars: profile(rule) wraps a rule's
+// parse function in the same way as qi::debug() does and records for each
+// rule the number of invocations, successes and failures, the bytes consumed,
+// and the cumulative inclusive and self time.
+//
+// The results are printed as a table, or written as folded stacks ("Start;
+// Block;Paragraph 1234" per line, in microseconds of self time), which can be
+// turned into a flamegraph by flamegraph.pl. Rules should be named with
+// rule.name() before profiling them.
+
+#ifndef RULE_PROFILER_HEADER
+#define RULE_PROFILER_HEADER
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+/******************************************************************************/
+
+class RuleProfiler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    //! statistics of a profiled rule
+    struct RuleStats
+    {
+        std::string name;
+        size_t calls = 0, successes = 0, failures = 0;
+        size_t bytes = 0;
+        double inclusive = 0, self = 0;
+        //! number of active invocations, to count recursive time only once
+        size_t active = 0;
+    };
+
+    //! enable profiling of a rule
+    template <typename Iterator, typename T1, typename T2, typename T3,
+              typename T4>
+    void profile(boost::spirit::qi::rule<Iterator, T1, T2, T3, T4>& r)
+    {
+        using rule_type = boost::spirit::qi::rule<Iterator, T1, T2, T3, T4>;
+
+        // rules which were never defined must remain empty and fail
+        if (!r.f) return;
+
+        rules_.emplace_back();
+        rules_.back().name = r.name();
+
+        r.f = Handler<Iterator, typename rule_type::context_type,
+                      typename rule_type::skipper_type> {
+            r.f, this, rules_.size() - 1 };
+    }
+
+    //! reset all statistics
+    void clear()
+    {
+        for (RuleStats& r : rules_)
+            r = RuleStats { r.name };
+        folded_.clear();
+    }
+
+    const std::vector<RuleStats>& rules() const { return rules_; }
+
+    //! add the statistics of another profiler, whose rules were profiled in
+    //! the same order, e.g. of an equal grammar in another thread. The times
+    //! of concurrent threads are summed up.
+    void merge(const RuleProfiler& other)
+    {
+        assert(rules_.size() == other.rules_.size());
+        for (size_t i = 0; i < rules_.size(); ++i) {
+            RuleStats& r = rules_[i];
+            const RuleStats& o = other.rules_[i];
+            r.calls += o.calls, r.successes += o.successes;
+            r.failures += o.failures, r.bytes += o.bytes;
+            r.inclusive += o.inclusive, r.self += o.self;
+        }
+        for (const auto& f : other.folded_)
+            folded_[f.first] += f.second;
+    }
+
+    //! print a table of all rules which were invoked, by decreasing self time
+    void print_table(std::ostream& os) const
+    {
+        std::vector<const RuleStats*> list;
+        for (const RuleStats& r : rules_) {
+            if (r.calls) list.push_back(&r);
+        }
+        std::sort(list.begin(), list.end(),
+                  [](const RuleStats* a, const RuleStats* b) {
+                      return a->self > b->self;
+                  });
+
+        os << std::left << std::setw(20) << "rule" << std::right
+           << std::setw(10) << "calls"
+           << std::setw(10) << "success"
+           << std::setw(10) << "fail"
+           << std::setw(12) << "bytes"
+           << std::setw(14) << "incl [us]"
+           << std::setw(14) << "self [us]" << std::endl;
+        for (const RuleStats* r : list) {
+            os << std::left << std::setw(20) << r->name << std::right
+               << std::setw(10) << r->calls
+               << std::setw(10) << r->successes
+               << std::setw(10) << r->failures
+               << std::setw(12) << r->bytes
+               << std::setw(14) << std::fixed << std::setprecision(1)
+               << r->inclusive * 1e6
+               << std::setw(14) << r->self * 1e6 << std::endl;
+        }
+        os.unsetf(std::ios_base::floatfield);
+    }
+
+    //! write the self times of all rule call stacks in folded stack format
+    void write_folded(std::ostream& os) const
+    {
+        for (const auto& f : folded_)
+            os << f.first << ' ' << static_cast<long long>(f.second * 1e6)
+               << std::endl;
+    }
+
+private:
+    //! an active rule invocation
+    struct Frame
+    {
+        size_t rule;
+        clock::time_point start;
+        double child_time;
+        size_t path_size;
+    };
+
+    std::vector<RuleStats> rules_;
+    std::vector<Frame> stack_;
+    //! current call stack as "Start;Block;..."
+    std::string path_;
+    //! self time per call stack
+    std::map<std::string, double> folded_;
+
+    void enter(size_t rule)
+    {
+        RuleStats& r = rules_[rule];
+        ++r.calls, ++r.active;
+        stack_.push_back(Frame { rule, clock::now(), 0.0, path_.size() });
+        if (!path_.empty()) path_ += ';';
+        path_ += r.name;
+    }
+
+    void leave(bool success, size_t bytes)
+    {
+        Frame f = stack_.back();
+        stack_.pop_back();
+
+        double elapsed =
+            std::chrono::duration<double>(clock::now() - f.start).count();
+        double self = elapsed - f.child_time;
+
+        RuleStats& r = rules_[f.rule];
+        if (success)
+            ++r.successes, r.bytes += bytes;
+        else
+            ++r.failures;
+        if (--r.active == 0)
+            r.inclusive += elapsed;
+        r.self += self;
+
+        folded_[path_] += self;
+        path_.resize(f.path_size);
+
+        if (!stack_.empty())
+            stack_.back().child_time += elapsed;
+    }
+
+    //! replacement parse function, modeled after qi::debug_handler
+    template <typename Iterator, typename Context, typename Skipper>
+    struct Handler
+    {
+        boost::function<bool(Iterator& first, Iterator const& last,
+                             Context& context, Skipper const& skipper)>
+        subject;
+        RuleProfiler* profiler;
+        size_t rule;
+
+        bool operator () (Iterator& first, Iterator const& last,
+                          Context& context, Skipper const& skipper) const
+        {
+            Iterator start = first;
+            profiler->enter(rule);
+            try {
+                bool success = subject(first, last, context, skipper);
+                profiler->leave(success, std::distance(start, first));
+                return success;
+            }
+            catch (...) {
+                profiler->leave(false, 0);
+                throw;
+            }
+        }
+    };
+};
+
+/******************************************************************************/
+
+#endif // !RULE_PROFILER_HEADER
@@ -12,6 +12,8 @@
 
 #include <boost/spirit/include/qi.hpp>
 
+#include "parse_stats.hpp"
+
 namespace qi = boost::spirit::qi;
 
 /******************************************************************************/
@@ -84,6 +86,7 @@ void test3()
 template <typename Parser, typename ... Args>
 void ParseOrDie(const std::string& input, const Parser& p, Args&& ... args)
 {
+    ParseStatsScope stats("ParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     bool ok = qi::parse(begin, end, p, std::forward<Args>(args) ...);
     if (!ok || begin != end) {
@@ -120,6 +123,7 @@ void PhraseParseOrDie(
     const std::string& input, const Parser& p, const Skipper& s,
     Args&& ... args)
 {
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     boost::spirit::qi::phrase_parse(
         begin, end, p, s, std::forward<Args>(args) ...);
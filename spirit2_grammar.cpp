@@ -7,13 +7,23 @@
 // test4() parses "1 + 2 * 3"
 //
 // Evaluation of the expression is added in spirit3_arithmetic.cpp
+//
+// "spirit2_grammar --bench" measures the throughput of recognition only, and
+// "spirit2_grammar --profile [EXPR]" prints a per-rule profile of test4's
+// grammar.
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
 
 #include <boost/spirit/include/qi.hpp>
 
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
+
 namespace qi = boost::spirit::qi;
 
 /******************************************************************************/
@@ -22,6 +32,7 @@ namespace qi = boost::spirit::qi;
 template <typename Parser, typename ... Args>
 void ParseOrDie(const std::string& input, const Parser& p, Args&& ... args)
 {
+    ParseStatsScope stats("ParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     bool ok = qi::parse(begin, end, p, std::forward<Args>(args) ...);
     if (!ok || begin != end) {
@@ -137,6 +148,7 @@ void PhraseParseOrDie(
     const std::string& input, const Parser& p, const Skipper& s,
     Args&& ... args)
 {
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     boost::spirit::qi::phrase_parse(
         begin, end, p, s, std::forward<Args>(args) ...);
@@ -166,6 +178,15 @@ public:
         group   = '(' >> start >> ')';
     }
 
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        start.name("start"), profiler.profile(start);
+        group.name("group"), profiler.profile(group);
+        product.name("product"), profiler.profile(product);
+        factor.name("factor"), profiler.profile(factor);
+    }
+
     // as before, mirrors the template arguments of qi::grammar.
     qi::rule<Iterator, int(), qi::space_type> start, group, product, factor;
 };
@@ -188,10 +209,87 @@ void test4(std::string input)
               << out_int << std::endl;
 }
 
+/******************************************************************************/
+// Throughput benchmark of recognition only, and of the grammars with an int()
+// attribute. Their attribute is not the value of the expression, hence the
+// checksums are all zero.
+
+void test5_benchmark()
+{
+    // construct the grammars once, outside the timing loop
+    ArithmeticGrammar3 g3;
+    ArithmeticGrammar4 g4;
+
+    RunExpressionBenchmarks(
+        "spirit2_grammar",
+        [&](const std::string& input, size_t terms, size_t depth, size_t reps) {
+            RunBenchmark(
+                "arithmetic_eval", "spirit2_recognize",
+                input, terms, depth, reps,
+                [&](const std::string& input) {
+                    PhraseParseOrDie(input, g4, qi::space);
+                    return 0.0;
+                });
+
+            RunBenchmark(
+                "arithmetic_eval", "spirit2_int_attribute",
+                input, terms, depth, reps,
+                [&](const std::string& input) {
+                    int out_int;
+                    PhraseParseOrDie(input, g4, qi::space, out_int);
+                    return 0.0;
+                });
+
+            // ArithmeticGrammar3 has no skip parser
+            std::string compact = input;
+            compact.erase(std::remove(compact.begin(), compact.end(), ' '),
+                          compact.end());
+
+            RunBenchmark(
+                "arithmetic_eval", "spirit2_int_attribute_noskip",
+                compact, terms, depth, reps,
+                [&](const std::string& input) {
+                    int out_int;
+                    ParseOrDie(input, g3, out_int);
+                    return 0.0;
+                });
+        });
+}
+
+/******************************************************************************/
+// Profile the rules of ArithmeticGrammar4 while parsing an expression. Prints
+// a table sorted by self time and writes folded stacks to
+// spirit2_grammar.folded, which flamegraph.pl turns into a flamegraph.
+
+void test6_profile(const std::string& input)
+{
+    ArithmeticGrammar4 g;
+    RuleProfiler profiler;
+    g.profile(profiler);
+
+    PhraseParseOrDie(input, g, qi::space);
+
+    profiler.print_table(std::cout);
+    std::ofstream folded("spirit2_grammar.folded");
+    profiler.write_folded(folded);
+}
+
 /******************************************************************************/
 
 int main(int argc, char* argv[])
 {
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        test5_benchmark();
+        return 0;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--profile") {
+        // by default a long generated expression
+        std::mt19937 rng(42);
+        test6_profile(argc >= 3 ? argv[2] : GenerateExpression(rng, 10000, 2));
+        return 0;
+    }
+
     test1();
     test2();
     test3();
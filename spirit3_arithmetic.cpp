@@ -1,6 +1,12 @@
 // Example how to use Boost Spirit to parse and _evaluate_ a simple arithmetic
 // grammar. Evaluation is added by amending rules with semantic actions.
+//
+// ArithmeticGrammar2 is templated on the value type (int64, double, or an
+// overflow-checked integer). "spirit3_arithmetic --bench" measures throughput,
+// and "spirit3_arithmetic --profile [EXPR]" prints a per-rule profile.
 
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
@@ -9,6 +15,10 @@
 #include <boost/spirit/include/phoenix_core.hpp>
 #include <boost/spirit/include/phoenix_operator.hpp>
 
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
+
 namespace qi = boost::spirit::qi;
 
 /******************************************************************************/
@@ -21,6 +31,7 @@ void PhraseParseOrDie(
     const std::string& input, const Parser& p, const Skipper& s,
     Args&& ... args)
 {
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     boost::spirit::qi::phrase_parse(
         begin, end, p, s, std::forward<Args>(args) ...);
@@ -76,11 +87,188 @@ void test1(std::string input)
               << out_int << std::endl;
 }
 
+/******************************************************************************/
+// The same single-pass evaluation, but templated on the value type. The value
+// type only needs += and *= operators, and ValueParser<Value> selects the
+// Spirit parser for the literals.
+
+// An integer which throws on overflow instead of silently wrapping around.
+template <typename Int>
+class CheckedInt
+{
+public:
+    CheckedInt(Int value = 0) : value_(value) { }
+
+    CheckedInt& operator += (const CheckedInt& b) {
+        if (__builtin_add_overflow(value_, b.value_, &value_))
+            throw std::overflow_error("Integer overflow in addition");
+        return *this;
+    }
+
+    CheckedInt& operator *= (const CheckedInt& b) {
+        if (__builtin_mul_overflow(value_, b.value_, &value_))
+            throw std::overflow_error("Integer overflow in multiplication");
+        return *this;
+    }
+
+    Int value() const { return value_; }
+
+    // the benchmarks convert each result to double, like the other types
+    explicit operator double () const { return static_cast<double>(value_); }
+
+    friend std::ostream& operator << (std::ostream& os, const CheckedInt& c) {
+        return os << c.value_;
+    }
+
+private:
+    Int value_;
+};
+
+// the literal parser of each value type
+template <typename Value>
+struct ValueParser;
+
+template <>
+struct ValueParser<int64_t> {
+    static qi::long_long_type parser() { return qi::long_long; }
+};
+
+template <>
+struct ValueParser<double> {
+    static qi::double_type parser() { return qi::double_; }
+};
+
+template <typename Int>
+struct ValueParser<CheckedInt<Int> > {
+    // literals are parsed as Int, which already fails if they overflow
+    static qi::int_parser<Int> parser() { return qi::int_parser<Int>(); }
+};
+
+template <typename Value>
+class ArithmeticGrammar2 : public qi::grammar<
+    std::string::const_iterator, Value(), qi::space_type>
+{
+public:
+    using Iterator = std::string::const_iterator;
+
+    ArithmeticGrammar2() : ArithmeticGrammar2::base_type(start)
+    {
+        start   = product [qi::_val = qi::_1]
+            >> *('+' >> product [qi::_val += qi::_1]);
+
+        product = factor [qi::_val = qi::_1]
+            >> *('*' >> factor [qi::_val *= qi::_1]);
+
+        factor  = ValueParser<Value>::parser() [qi::_val = qi::_1] |
+            group [qi::_val = qi::_1];
+
+        group   %= '(' >> start >> ')';
+    }
+
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        start.name("start"), profiler.profile(start);
+        group.name("group"), profiler.profile(group);
+        product.name("product"), profiler.profile(product);
+        factor.name("factor"), profiler.profile(factor);
+    }
+
+    qi::rule<Iterator, Value(), qi::space_type> start, group, product, factor;
+};
+
+template <typename Value>
+void test2(std::string input, const char* name)
+{
+    try {
+        Value out_value;
+
+        PhraseParseOrDie(input, ArithmeticGrammar2<Value>(), qi::space,
+                         out_value);
+
+        std::cout << "test2<" << name << ">() parse result: "
+                  << out_value << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cout << "test2<" << name << ">() EXCEPTION: " << e.what()
+                  << std::endl;
+    }
+}
+
+/******************************************************************************/
+// Throughput benchmark of the single-pass evaluation, compare with the RESULT
+// lines of "spirit5_ast --bench", which builds and evaluates an AST.
+
+template <typename Value>
+void BenchmarkValue(const char* name, const std::string& input,
+                    size_t terms, size_t depth, size_t reps)
+{
+    // construct the grammar once, outside the timing loop
+    ArithmeticGrammar2<Value> g;
+
+    RunBenchmark(
+        "arithmetic_eval", std::string("spirit3_") + name,
+        input, terms, depth, reps,
+        [&](const std::string& input) {
+            Value out_value;
+            PhraseParseOrDie(input, g, qi::space, out_value);
+            return static_cast<double>(out_value);
+        });
+}
+
+void test3_benchmark()
+{
+    RunExpressionBenchmarks(
+        "spirit3_arithmetic",
+        [](const std::string& input, size_t terms, size_t depth, size_t reps) {
+            BenchmarkValue<int64_t>("int64", input, terms, depth, reps);
+            BenchmarkValue<double>("double", input, terms, depth, reps);
+            BenchmarkValue<CheckedInt<int64_t> >(
+                "checked_int64", input, terms, depth, reps);
+        });
+}
+
+/******************************************************************************/
+// Profile the rules of ArithmeticGrammar2<double> while parsing an expression.
+// Prints a table sorted by self time and writes folded stacks to
+// spirit3_arithmetic.folded, which flamegraph.pl turns into a flamegraph.
+
+void test4_profile(const std::string& input)
+{
+    ArithmeticGrammar2<double> g;
+    RuleProfiler profiler;
+    g.profile(profiler);
+
+    double out_value;
+    PhraseParseOrDie(input, g, qi::space, out_value);
+
+    profiler.print_table(std::cout);
+    std::ofstream folded("spirit3_arithmetic.folded");
+    profiler.write_folded(folded);
+}
+
 /******************************************************************************/
 
 int main(int argc, char* argv[])
 {
-    test1(argc >= 2 ? argv[1] : "1 + 2 * 3");
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        test3_benchmark();
+        return 0;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--profile") {
+        // by default a long generated expression
+        std::mt19937 rng(42);
+        test4_profile(argc >= 3 ? argv[2] : GenerateExpression(rng, 10000, 2));
+        return 0;
+    }
+
+    std::string input = argc >= 2 ? argv[1] : "1 + 2 * 3";
+    test1(input);
+    test2<int64_t>(input, "int64");
+    test2<double>(input, "double");
+    test2<CheckedInt<int32_t> >(input, "checked_int32");
+    test2<CheckedInt<int64_t> >(input, "checked_int64");
 
     return 0;
 }
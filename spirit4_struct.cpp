@@ -1,6 +1,7 @@
 // Example how to use Boost Spirit to parse CSV data directly into a C++ struct
 //
-// This example is designed to read the file "stock_list.txt"
+// This example is designed to read the file "stock_list.txt".
+// "spirit4_struct --profile [FILE]" prints a per-rule profile of StockGrammar1.
 
 #include <fstream>
 #include <iomanip>
@@ -11,6 +12,9 @@
 #include <boost/spirit/include/phoenix.hpp>
 #include <boost/fusion/include/adapt_struct.hpp>
 
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
+
 namespace qi = boost::spirit::qi;
 namespace phx = boost::phoenix;
 
@@ -20,6 +24,7 @@ namespace phx = boost::phoenix;
 template <typename Parser, typename ... Args>
 void ParseOrDie(const std::string& input, const Parser& p, Args&& ... args)
 {
+    ParseStatsScope stats("ParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     bool ok = qi::parse(begin, end, p, std::forward<Args>(args) ...);
     if (!ok || begin != end) {
@@ -76,6 +81,13 @@ public:
             [qi::_val = phx::construct<Stock>(qi::_1, qi::_2, qi::_3) ];
     }
 
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        name.name("name"), profiler.profile(name);
+        start.name("start"), profiler.profile(start);
+    }
+
     // a helper rule which parser a name
     qi::rule<Iterator, std::string()> name;
     // rule which actually parses a CSV line containing the information
@@ -133,10 +145,43 @@ void test2_stream(std::istream& input)
     }
 }
 
+/******************************************************************************/
+// Profile the rules of StockGrammar1 while parsing each line of input. Prints
+// a table sorted by self time and writes folded stacks to spirit4_struct.folded,
+// which flamegraph.pl turns into a flamegraph.
+
+void test3_profile(std::istream& input)
+{
+    StockGrammar1 g;
+    RuleProfiler profiler;
+    g.profile(profiler);
+
+    std::string line;
+    while (std::getline(input, line)) {
+        Stock stock;
+        ParseOrDie(line, g, stock);
+    }
+
+    profiler.print_table(std::cout);
+    std::ofstream folded("spirit4_struct.folded");
+    profiler.write_folded(folded);
+}
+
 /******************************************************************************/
 
 int main(int argc, char* argv[])
 {
+    if (argc >= 2 && std::string(argv[1]) == "--profile") {
+        if (argc >= 3) {
+            std::ifstream in(argv[2]);
+            test3_profile(in);
+        }
+        else {
+            test3_profile(std::cin);
+        }
+        return 0;
+    }
+
     if (argc >= 2) {
         std::ifstream in(argv[1]);
         test1_stream(in);
@@ -2,16 +2,23 @@
 // for a simple arithmetic grammar and to evaluate expressions.
 //
 // The grammar accepts expressions like "1 + 2 * 3", constructs an AST and
-// evaluates it correctly.
+// evaluates it correctly. "spirit5_ast --bench" measures the throughput, and
+// "spirit5_ast --profile [EXPR]" prints a per-rule profile.
 
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
 #include <memory>
+#include <vector>
 
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/phoenix.hpp>
 
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
+
 namespace qi = boost::spirit::qi;
 namespace phx = boost::phoenix;
 
@@ -23,6 +30,7 @@ void PhraseParseOrDie(
     const std::string& input, const Parser& p, const Skipper& s,
     Args&& ... args)
 {
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
     boost::spirit::qi::phrase_parse(
         begin, end, p, s, std::forward<Args>(args) ...);
@@ -44,27 +52,46 @@ public:
 
 using ASTNodePtr = ASTNode*;
 
+// OperatorNode is an n-ary node which applies the operator to a whole list of
+// operands, like 1 + 2 + 3 + 4. The grammar folds each sequence of + or * into
+// one node, hence the tree's depth only grows with the parenthesis nesting,
+// and long expressions are evaluated and deleted in loops instead of deep
+// recursions.
 template <char Operator>
 class OperatorNode : public ASTNode
 {
 public:
     OperatorNode(const ASTNodePtr& left, const ASTNodePtr& right)
-        : left(left), right(right) { }
+        : operands({ left, right }) { }
 
     double evaluate() {
-        if (Operator == '+')
-            return left->evaluate() + right->evaluate();
-        else if (Operator == '*')
-            return left->evaluate() * right->evaluate();
+        double result = operands[0]->evaluate();
+        for (size_t i = 1; i < operands.size(); ++i) {
+            if (Operator == '+')
+                result += operands[i]->evaluate();
+            else if (Operator == '*')
+                result *= operands[i]->evaluate();
+        }
+        return result;
+    }
+
+    // semantic action helper: extend the operator node in left with another
+    // operand, or create a new one if left is a different node.
+    static ASTNodePtr append(const ASTNodePtr& left, const ASTNodePtr& right) {
+        if (OperatorNode* op = dynamic_cast<OperatorNode*>(left)) {
+            op->operands.push_back(right);
+            return op;
+        }
+        return new OperatorNode(left, right);
     }
 
     ~OperatorNode() {
-        delete left;
-        delete right;
+        for (ASTNodePtr& node : operands)
+            delete node;
     }
 
 private:
-    ASTNodePtr left, right;
+    std::vector<ASTNodePtr> operands;
 };
 
 class ConstantNode : public ASTNode
@@ -91,17 +118,31 @@ public:
 
     ArithmeticGrammar1() : ArithmeticGrammar1::base_type(start)
     {
-        start = (product >> '+' >> start)
-            [qi::_val = phx::new_<OperatorNode<'+'> >(qi::_1, qi::_2) ] |
-            product [qi::_val = qi::_1];
-        product = (factor >> '*' >> product)
-            [qi::_val = phx::new_<OperatorNode<'*'> >(qi::_1, qi::_2) ] |
-            factor [qi::_val = qi::_1];
+        // the first product is the result, all following ones are appended
+        // to one n-ary OperatorNode. There is no backtracking: each product
+        // is parsed exactly once.
+        start = product [qi::_val = qi::_1]
+            >> *('+' >> product [
+                     qi::_val = phx::bind(&OperatorNode<'+'>::append,
+                                          qi::_val, qi::_1) ]);
+        product = factor [qi::_val = qi::_1]
+            >> *('*' >> factor [
+                     qi::_val = phx::bind(&OperatorNode<'*'>::append,
+                                          qi::_val, qi::_1) ]);
         factor  = group [qi::_val = qi::_1] |
             qi::int_ [qi::_val = phx::new_<ConstantNode>(qi::_1) ];
         group   %= '(' >> start >> ')';
     }
 
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        start.name("start"), profiler.profile(start);
+        group.name("group"), profiler.profile(group);
+        product.name("product"), profiler.profile(product);
+        factor.name("factor"), profiler.profile(factor);
+    }
+
     qi::rule<Iterator, ASTNodePtr(), qi::space_type> start, group, product, factor;
 };
 
@@ -114,10 +155,66 @@ void test1(std::string input)
     delete out_node;
 }
 
+/******************************************************************************/
+// Throughput benchmark of parsing into an AST and evaluating it, compare with
+// the RESULT lines of "spirit3_arithmetic --bench", which evaluates directly.
+
+void test2_benchmark()
+{
+    // construct the grammar once, outside the timing loop
+    ArithmeticGrammar1 g;
+
+    RunExpressionBenchmarks(
+        "spirit5_ast",
+        [&](const std::string& input, size_t terms, size_t depth, size_t reps) {
+            RunBenchmark(
+                "arithmetic_eval", "spirit5_ast", input, terms, depth, reps,
+                [&](const std::string& input) {
+                    ASTNode* out_node;
+                    PhraseParseOrDie(input, g, qi::space, out_node);
+                    double result = out_node->evaluate();
+                    delete out_node;
+                    return result;
+                });
+        });
+}
+
+/******************************************************************************/
+// Profile the rules of ArithmeticGrammar1 while parsing an expression. Prints
+// a table sorted by self time and writes folded stacks to spirit5_ast.folded,
+// which flamegraph.pl turns into a flamegraph.
+
+void test3_profile(const std::string& input)
+{
+    ArithmeticGrammar1 g;
+    RuleProfiler profiler;
+    g.profile(profiler);
+
+    ASTNode* out_node = nullptr;
+    PhraseParseOrDie(input, g, qi::space, out_node);
+    delete out_node;
+
+    profiler.print_table(std::cout);
+    std::ofstream folded("spirit5_ast.folded");
+    profiler.write_folded(folded);
+}
+
 /******************************************************************************/
 
 int main(int argc, char* argv[])
 {
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        test2_benchmark();
+        return 0;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--profile") {
+        // by default a long generated expression
+        std::mt19937 rng(42);
+        test3_profile(argc >= 3 ? argv[2] : GenerateExpression(rng, 10000, 2));
+        return 0;
+    }
+
     test1(argc >= 2 ? argv[1] : "1 + 2 * 3");
 
     return 0;
@@ -3,16 +3,40 @@
 //
 // The grammar accepts expressions like "y = 1 + 2 * x", constructs an AST and
 // evaluates it correctly. Non-assignment expression are also evaluated.
+//
+// Called with a thread count argument, e.g. "spirit6_ast 4", all stdin lines are
+// parsed first and then evaluated as independent expressions in parallel.
+// "spirit6_ast --emit" prints C++ code to register specialized formulas, and
+// "--specialized" registers the example formulas generated this way.
+// Compiled formulas are cached, "--cache-size N" sets the LRU cache capacity.
+// "--precedence" switches to the operator-precedence parser which also accepts
+// - / ^ and unary minus, and "--bench" compares the two parsers' speed.
+// "--profile" prints a per-rule profile of parsing stdin. Options may be given
+// in any order.
 
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/phoenix.hpp>
 
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
+
 namespace qi = boost::spirit::qi;
 namespace phx = boost::phoenix;
 
@@ -24,10 +48,13 @@ void PhraseParseOrDie(
     const std::string& input, const Parser& p, const Skipper& s,
     Args&& ... args)
 {
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
     std::string::const_iterator begin = input.begin(), end = input.end();
-    boost::spirit::qi::phrase_parse(
+    // an empty line fails without consuming anything, which leaves the
+    // output node unset
+    bool r = boost::spirit::qi::phrase_parse(
         begin, end, p, s, std::forward<Args>(args) ...);
-    if (begin != end) {
+    if (!r || begin != end) {
         std::cout << "Unparseable: "
                   << std::quoted(std::string(begin, end)) << std::endl;
         throw std::runtime_error("Parse error");
@@ -36,39 +63,167 @@ void PhraseParseOrDie(
 
 /******************************************************************************/
 
-// the variable value map
-std::map<std::string, double> variable_map;
+// The symbol table interns variable identifiers while parsing and assigns each
+// distinct name a dense slot index. The AST then only stores slot indexes, and
+// variable values live in a flat EvalContext array indexed by these slots.
+class SymbolTable
+{
+public:
+    // return the slot of an identifier, allocating a new slot if it is unknown
+    size_t intern(const std::string& identifier) {
+        auto it = slots_.find(identifier);
+        if (it != slots_.end())
+            return it->second;
+        slots_.emplace(identifier, names_.size());
+        names_.push_back(identifier);
+        return names_.size() - 1;
+    }
+
+    // number of slots allocated
+    size_t size() const { return names_.size(); }
+
+    // reverse lookup of the identifier of a slot
+    const std::string& name(size_t slot) const { return names_[slot]; }
+
+private:
+    std::map<std::string, size_t> slots_;
+    std::vector<std::string> names_;
+};
+
+// The evaluation context holds the variable values, indexed by the slots of a
+// SymbolTable. There is no global state: the context is passed to evaluate(),
+// hence multiple threads can evaluate ASTs, each with its own context.
+class EvalContext
+{
+public:
+    EvalContext() = default;
+
+    explicit EvalContext(const SymbolTable& symbols)
+        : values_(symbols.size()) { }
+
+    double& operator [] (size_t slot) { return values_[slot]; }
+    const double& operator [] (size_t slot) const { return values_[slot]; }
+
+    // grow the context after new symbols were interned, they start as zero.
+    void resize(size_t size) { values_.resize(size); }
+
+    size_t size() const { return values_.size(); }
+
+private:
+    std::vector<double> values_;
+};
 
 class ASTNode
 {
 public:
-    virtual double evaluate() = 0;
+    virtual double evaluate(EvalContext& ctx) = 0;
+
+    // optimization pass: simplify() consumes the node and returns the node
+    // which replaces it in the AST. By default nodes are kept as they are.
+    virtual ASTNode* simplify() { return this; }
+
+    // print the node as a C++ expression template type for a specialized
+    // formula, see below. vars collects the names of variables in the formula.
+    // Nodes without an expression template counterpart cannot be specialized.
+    virtual void emit(std::ostream& /* os */, const SymbolTable& /* symbols */,
+                      std::vector<std::string>& /* vars */) const {
+        throw std::runtime_error("Formula is not specializable");
+    }
+
     virtual ~ASTNode() { }
 };
 
 using ASTNodePtr = ASTNode*;
 
+// returns the index of a variable in the list of an emitted formula
+size_t EmitVariable(const std::string& name, std::vector<std::string>& vars)
+{
+    for (size_t i = 0; i < vars.size(); ++i) {
+        if (vars[i] == name) return i;
+    }
+    vars.push_back(name);
+    return vars.size() - 1;
+}
+
+// OperatorNode is an n-ary node which applies the operator from left to right
+// to a whole list of operands, like 1 + 2 + 3 + 4 = ((1 + 2) + 3) + 4. The
+// grammars append each further operand of a chain to one node, as in spirit5,
+// hence the tree's depth only grows with the parenthesis nesting, and long
+// expressions are evaluated, emitted and deleted in loops instead of deep
+// recursions.
 template <char Operator>
 class OperatorNode : public ASTNode
 {
 public:
     OperatorNode(const ASTNodePtr& left, const ASTNodePtr& right)
-        : left(left), right(right) { }
+        : operands({ left, right }) { }
 
-    double evaluate() {
+    // calculate the operator on two values
+    static double apply(double left, double right) {
+        static_assert(Operator == '+' || Operator == '-' || Operator == '*' ||
+                      Operator == '/' || Operator == '^', "Unknown operator");
         if (Operator == '+')
-            return left->evaluate() + right->evaluate();
+            return left + right;
+        else if (Operator == '-')
+            return left - right;
         else if (Operator == '*')
-            return left->evaluate() * right->evaluate();
+            return left * right;
+        else if (Operator == '/')
+            return left / right;
+        else
+            return std::pow(left, right);
+    }
+
+    double evaluate(EvalContext& ctx) {
+        double result = operands[0]->evaluate(ctx);
+        for (size_t i = 1; i < operands.size(); ++i)
+            result = apply(result, operands[i]->evaluate(ctx));
+        return result;
+    }
+
+    // semantic action helper: extend the operator node in left with another
+    // operand, or create a new one if left is a different node. Appending
+    // keeps the left-to-right order of evaluation.
+    static ASTNodePtr append(const ASTNodePtr& left, const ASTNodePtr& right) {
+        if (OperatorNode* op = dynamic_cast<OperatorNode*>(left)) {
+            op->operands.push_back(right);
+            return op;
+        }
+        return new OperatorNode(left, right);
+    }
+
+    // folds constants and removes identity operands, see below
+    ASTNodePtr simplify();
+
+    // emitted as nested binary Operator<> types in the order of evaluation:
+    // a + b + c is Operator<'+', Operator<'+', a, b>, c>.
+    void emit(std::ostream& os, const SymbolTable& symbols,
+              std::vector<std::string>& vars) const {
+        for (size_t i = 1; i < operands.size(); ++i)
+            os << "Operator<'" << Operator << "', ";
+        operands[0]->emit(os, symbols, vars);
+        for (size_t i = 1; i < operands.size(); ++i) {
+            os << ", ";
+            operands[i]->emit(os, symbols, vars);
+            os << '>';
+        }
     }
 
     ~OperatorNode() {
-        delete left;
-        delete right;
+        for (ASTNodePtr& node : operands)
+            delete node;
     }
 
 private:
-    ASTNodePtr left, right;
+    std::vector<ASTNodePtr> operands;
+
+    // right neutral element of the operator: x + 0 = x - 0 = x and x * 1 =
+    // x / 1 = x ^ 1 = x.
+    static constexpr double identity =
+        (Operator == '+' || Operator == '-' ? 0.0 : 1.0);
+
+    // 0 + x = x and 1 * x = x, the identity may also be the left operand
+    static constexpr bool commutative = (Operator == '+' || Operator == '*');
 };
 
 class ConstantNode : public ASTNode
@@ -77,45 +232,312 @@ public:
     ConstantNode(double value)
         : value(value) { }
 
-    double evaluate() {
+    double evaluate(EvalContext&) {
         return value;
     }
 
+    double constant() const { return value; }
+
+    void emit(std::ostream& os, const SymbolTable&,
+              std::vector<std::string>&) const {
+        // the parser only creates integer constants
+        os << "Constant<" << static_cast<long long>(value) << '>';
+    }
+
 private:
     double value;
 };
 
+// simplify() never changes the order in which floating point operations are
+// evaluated, since reassociating them may change the result: with x = 1,
+// 1e16 + x - 1e16 is 0, but folding the constants to x + 0 would yield 1.
+// Hence only operands which are evaluated one after the other are combined:
+// subtrees which are entirely constant, like (2 + 3) in x * (2 + 3), and a
+// leading run of constants, like 2 * 3 * x. A leading subchain of the same
+// operator, like (a + b) in (a + b) + c, is merged into the node, because it
+// is evaluated first anyway. Constants after a non-constant operand are kept,
+// as in x + 1 + 2, except identities like x * 1, which are removed.
+template <char Operator>
+ASTNodePtr OperatorNode<Operator>::simplify()
+{
+    std::vector<ASTNodePtr> input;
+    input.swap(operands);
+
+    for (size_t i = 0; i < input.size(); ++i) {
+        ASTNodePtr node = input[i]->simplify();
+        input[i] = nullptr;
+
+        if (i == 0) {
+            if (OperatorNode* op = dynamic_cast<OperatorNode*>(node)) {
+                // take over the operands of the leading subchain
+                operands.swap(op->operands);
+                delete op;
+            }
+            else {
+                operands.push_back(node);
+            }
+            continue;
+        }
+
+        ConstantNode* c = dynamic_cast<ConstantNode*>(node);
+        ConstantNode* prefix = operands.size() == 1
+            ? dynamic_cast<ConstantNode*>(operands[0]) : nullptr;
+
+        if (c && c->constant() == identity) {
+            delete c;
+        }
+        else if (c && prefix) {
+            // the whole prefix is constant
+            operands[0] = new ConstantNode(
+                apply(prefix->constant(), c->constant()));
+            delete prefix;
+            delete c;
+        }
+        else if (commutative && prefix && prefix->constant() == identity) {
+            operands[0] = node;
+            delete prefix;
+        }
+        else {
+            operands.push_back(node);
+        }
+    }
+
+    if (operands.size() != 1)
+        return this;
+
+    ASTNodePtr result = operands[0];
+    operands.clear();
+    delete this;
+    return result;
+}
+
 class VariableNode : public ASTNode
 {
 public:
-    VariableNode(std::string identifier)
-        : identifier(identifier) { }
+    VariableNode(size_t slot)
+        : slot(slot) { }
+
+    double evaluate(EvalContext& ctx) {
+        return ctx[slot];
+    }
+
+    void emit(std::ostream& os, const SymbolTable& symbols,
+              std::vector<std::string>& vars) const {
+        os << "Variable<" << EmitVariable(symbols.name(slot), vars) << '>';
+    }
+
+private:
+    size_t slot;
+};
+
+class NegateNode : public ASTNode
+{
+public:
+    NegateNode(const ASTNodePtr& operand)
+        : operand(operand) { }
+
+    double evaluate(EvalContext& ctx) {
+        return -operand->evaluate(ctx);
+    }
+
+    ASTNodePtr simplify() {
+        operand = operand->simplify();
+        if (ConstantNode* c = dynamic_cast<ConstantNode*>(operand)) {
+            ASTNodePtr result = new ConstantNode(-c->constant());
+            delete this;
+            return result;
+        }
+        return this;
+    }
+
+    void emit(std::ostream& os, const SymbolTable& symbols,
+              std::vector<std::string>& vars) const {
+        os << "Negate<";
+        operand->emit(os, symbols, vars);
+        os << '>';
+    }
 
-    double evaluate() {
-        return variable_map[identifier];
+    ~NegateNode() {
+        delete operand;
     }
 
 private:
-    std::string identifier;
+    ASTNodePtr operand;
 };
 
 class AssignmentNode : public ASTNode
 {
 public:
-    AssignmentNode(std::string identifier, const ASTNodePtr& value)
-        : identifier(identifier), value(value) { }
+    AssignmentNode(size_t slot, const ASTNodePtr& value)
+        : slot(slot), value(value) { }
 
-    double evaluate() {
-        double v = value->evaluate();
-        variable_map[identifier] = v;
+    double evaluate(EvalContext& ctx) {
+        double v = value->evaluate(ctx);
+        ctx[slot] = v;
         return v;
     }
 
+    ASTNodePtr simplify() {
+        value = value->simplify();
+        return this;
+    }
+
+    void emit(std::ostream& os, const SymbolTable& symbols,
+              std::vector<std::string>& vars) const {
+        os << "Assignment<" << EmitVariable(symbols.name(slot), vars) << ", ";
+        value->emit(os, symbols, vars);
+        os << '>';
+    }
+
+    ~AssignmentNode() {
+        delete value;
+    }
+
 private:
-    std::string identifier;
+    size_t slot;
     ASTNodePtr value;
 };
 
+/******************************************************************************/
+// Specialized formulas: for the few formulas which are evaluated very often,
+// the AST can be emitted as a C++ expression template type (--emit mode). The
+// type is then compiled into the program and registered under the formula's
+// text. The template's static evaluate() functions are all inlined by the
+// compiler into one straight-line function without any virtual calls.
+//
+// Variables are numbered in order of appearance in the formula, and are bound
+// to the slots of the SymbolTable when the formula is looked up.
+
+namespace specialized {
+
+template <long long Value>
+struct Constant {
+    static double evaluate(EvalContext&, const size_t*) {
+        return Value;
+    }
+};
+
+template <size_t Index>
+struct Variable {
+    static double evaluate(EvalContext& ctx, const size_t* slots) {
+        return ctx[slots[Index]];
+    }
+};
+
+// mirrors OperatorNode<Operator>
+template <char Op, typename Left, typename Right>
+struct Operator {
+    static double evaluate(EvalContext& ctx, const size_t* slots) {
+        return OperatorNode<Op>::apply(
+            Left::evaluate(ctx, slots), Right::evaluate(ctx, slots));
+    }
+};
+
+template <typename Operand>
+struct Negate {
+    static double evaluate(EvalContext& ctx, const size_t* slots) {
+        return -Operand::evaluate(ctx, slots);
+    }
+};
+
+template <size_t Index, typename Value>
+struct Assignment {
+    static double evaluate(EvalContext& ctx, const size_t* slots) {
+        double v = Value::evaluate(ctx, slots);
+        ctx[slots[Index]] = v;
+        return v;
+    }
+};
+
+} // namespace specialized
+
+// formula text is matched without whitespace
+std::string NormalizeFormula(const std::string& text)
+{
+    std::string out;
+    for (char c : text) {
+        if (!std::isspace(static_cast<unsigned char>(c))) out += c;
+    }
+    return out;
+}
+
+// AST node calling the inlined evaluate() function of a specialized formula
+class SpecializedNode : public ASTNode
+{
+public:
+    using Function = double (*)(EvalContext& ctx, const size_t* slots);
+
+    SpecializedNode(Function function, std::vector<size_t> slots)
+        : function(function), slots(std::move(slots)) { }
+
+    double evaluate(EvalContext& ctx) {
+        return function(ctx, slots.data());
+    }
+
+private:
+    Function function;
+    std::vector<size_t> slots;
+};
+
+// Registry of specialized formulas by their text.
+class FormulaRegistry
+{
+public:
+    // register the expression template type Formula, vars are the names of the
+    // variables in the order emitted.
+    template <typename Formula>
+    void add(const std::string& text, std::vector<std::string> vars) {
+        map_[NormalizeFormula(text)] =
+            Entry { &Formula::evaluate, std::move(vars) };
+    }
+
+    // returns a SpecializedNode for the formula, or nullptr if unknown.
+    ASTNodePtr lookup(const std::string& text, SymbolTable& symbols) const {
+        auto it = map_.find(NormalizeFormula(text));
+        if (it == map_.end())
+            return nullptr;
+        std::vector<size_t> slots;
+        for (const std::string& name : it->second.vars)
+            slots.push_back(symbols.intern(name));
+        return new SpecializedNode(it->second.function, std::move(slots));
+    }
+
+private:
+    struct Entry {
+        SpecializedNode::Function function;
+        std::vector<std::string> vars;
+    };
+
+    std::map<std::string, Entry> map_;
+};
+
+// print the registration code of a formula's AST
+void EmitFormula(std::ostream& os, const std::string& text,
+                 const ASTNode& node, const SymbolTable& symbols)
+{
+    std::vector<std::string> vars;
+    std::ostringstream type;
+    node.emit(type, symbols, vars);
+
+    os << "registry.add<" << type.str() << ">(\n"
+       << "    " << std::quoted(NormalizeFormula(text)) << ", {";
+    for (size_t i = 0; i < vars.size(); ++i)
+        os << (i ? ", " : "") << std::quoted(vars[i]);
+    os << "});" << std::endl;
+}
+
+// example formulas, generated with "spirit6_ast --emit". They are only
+// registered with "spirit6_ast --specialized".
+void RegisterFormulas(FormulaRegistry& registry)
+{
+    using namespace specialized;
+
+    registry.add<Operator<'+', Operator<'+', Operator<'*', Variable<0>, Variable<0>>, Operator<'*', Constant<2>, Variable<0>>>, Constant<1>>>(
+        "x*x+2*x+1", {"x"});
+    registry.add<Assignment<0, Operator<'+', Operator<'*', Constant<2>, Variable<1>>, Constant<1>>>>(
+        "y=2*x+1", {"y", "x"});
+}
+
 /******************************************************************************/
 
 class ArithmeticGrammar1
@@ -124,38 +546,323 @@ class ArithmeticGrammar1
 public:
     using Iterator = std::string::const_iterator;
 
-    ArithmeticGrammar1() : ArithmeticGrammar1::base_type(start)
+    // the grammar interns all variable names into the symbol table
+    explicit ArithmeticGrammar1(SymbolTable& symbols)
+        : ArithmeticGrammar1::base_type(start)
     {
+        // resolves an identifier to its slot while parsing
+        auto slot_of = phx::bind(&SymbolTable::intern, phx::ref(symbols), qi::_1);
+
         varname %= qi::alpha >> *qi::alnum;
 
         start = (varname >> '=' >> term)
-            [qi::_val = phx::new_<AssignmentNode>(qi::_1, qi::_2) ] |
+            [qi::_val = phx::new_<AssignmentNode>(slot_of, qi::_2) ] |
             term [qi::_val = qi::_1];
 
-        term = (product >> '+' >> term)
-            [qi::_val = phx::new_<OperatorNode<'+'> >(qi::_1, qi::_2) ] |
-            product [qi::_val = qi::_1];
-        product = (factor >> '*' >> product)
-            [qi::_val = phx::new_<OperatorNode<'*'> >(qi::_1, qi::_2) ] |
-            factor [qi::_val = qi::_1];
+        // the first product is the result, all following ones are appended
+        // to one n-ary OperatorNode. Previously, "(product >> '+' >> term) | product" parsed
+        // the last product twice, which compounds exponentially with nested
+        // groups, and leaked the AST of the failed first attempt.
+        term = product [qi::_val = qi::_1]
+            >> *('+' >> product [
+                     qi::_val = phx::bind(&OperatorNode<'+'>::append,
+                                          qi::_val, qi::_1) ]);
+        product = factor [qi::_val = qi::_1]
+            >> *('*' >> factor [
+                     qi::_val = phx::bind(&OperatorNode<'*'>::append,
+                                          qi::_val, qi::_1) ]);
         factor  = group [qi::_val = qi::_1] |
-            varname [qi::_val = phx::new_<VariableNode>(qi::_1) ] |
+            varname [qi::_val = phx::new_<VariableNode>(slot_of) ] |
             qi::int_ [qi::_val = phx::new_<ConstantNode>(qi::_1) ];
         group   %= '(' >> term >> ')';
     }
 
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        varname.name("varname"), profiler.profile(varname);
+        start.name("start"), profiler.profile(start);
+        term.name("term"), profiler.profile(term);
+        group.name("group"), profiler.profile(group);
+        product.name("product"), profiler.profile(product);
+        factor.name("factor"), profiler.profile(factor);
+    }
+
     qi::rule<Iterator, std::string(), qi::space_type> varname;
     qi::rule<Iterator, ASTNodePtr(), qi::space_type> start, term, group, product, factor;
 };
 
+/******************************************************************************/
+// Operator-precedence (precedence climbing) parser: instead of one rule per
+// precedence level, the expression is parsed as a flat sequence of operands
+// and operators in one loop. The operators are reduced with a precedence
+// table on a stack (shunting-yard), which supports + - * / ^ and unary minus
+// without any rule calls or backtracking per precedence level.
+//
+// Since ArithmeticGrammar1 also parses its chains in loops without
+// backtracking, the precedence table does not make parsing faster: "--bench"
+// shows both grammars equally fast without parentheses, and the
+// PrecedenceGrammar 10-20% slower with nested groups, where each group
+// constructs another PrecedenceStack. Its benefit is the larger operator set.
+
+class PrecedenceStack
+{
+public:
+    PrecedenceStack() = default;
+    PrecedenceStack(const PrecedenceStack&) = delete;
+    PrecedenceStack& operator = (const PrecedenceStack&) = delete;
+
+    // precedence table: higher binds stronger. 'n' is unary minus, which binds
+    // stronger than * but weaker than ^, as in -x^2 = -(x^2).
+    static int precedence(char op) {
+        switch (op) {
+        case '+': case '-': return 1;
+        case '*': case '/': return 2;
+        case 'n': return 3;
+        case '^': return 4;
+        }
+        return 0;
+    }
+
+    // ^ is right-associative, 2^3^2 = 2^(3^2).
+    static bool right_assoc(char op) { return op == '^' || op == 'n'; }
+
+    // an operand with the number of prefix minus signs before it
+    struct Operand {
+        size_t negations;
+        ASTNodePtr node;
+
+        Operand() : negations(0), node(nullptr) { }
+        Operand(size_t negations, ASTNodePtr node)
+            : negations(negations), node(node) { }
+    };
+
+    void push_operand(const Operand& operand) {
+        // prefix operators do not reduce anything
+        operators_.insert(operators_.end(), operand.negations, 'n');
+        operands_.push_back(operand.node);
+    }
+
+    // reduce all operators on the stack which bind stronger than op
+    void push_operator(char op) {
+        while (!operators_.empty() &&
+               (precedence(operators_.back()) > precedence(op) ||
+                (precedence(operators_.back()) == precedence(op) &&
+                 !right_assoc(op))))
+            reduce();
+        operators_.push_back(op);
+    }
+
+    // reduce the remaining stack and return the result
+    ASTNodePtr finish() {
+        while (!operators_.empty())
+            reduce();
+        ASTNodePtr result = operands_.back();
+        operands_.clear();
+        return result;
+    }
+
+    ~PrecedenceStack() {
+        // only non-empty if parsing failed
+        for (ASTNodePtr node : operands_)
+            delete node;
+    }
+
+private:
+    std::vector<ASTNodePtr> operands_;
+    std::vector<char> operators_;
+
+    void reduce() {
+        char op = operators_.back();
+        operators_.pop_back();
+        ASTNodePtr right = operands_.back();
+        operands_.pop_back();
+        if (op == 'n') {
+            operands_.push_back(new NegateNode(right));
+            return;
+        }
+        // left-associative operators extend an n-ary node on the left
+        ASTNodePtr left = operands_.back();
+        switch (op) {
+        case '+': left = OperatorNode<'+'>::append(left, right); break;
+        case '-': left = OperatorNode<'-'>::append(left, right); break;
+        case '*': left = OperatorNode<'*'>::append(left, right); break;
+        case '/': left = OperatorNode<'/'>::append(left, right); break;
+        case '^': left = new OperatorNode<'^'>(left, right); break;
+        }
+        operands_.back() = left;
+    }
+};
+
+class PrecedenceGrammar
+    : public qi::grammar<std::string::const_iterator, ASTNodePtr(), qi::space_type>
+{
+public:
+    using Iterator = std::string::const_iterator;
+
+    explicit PrecedenceGrammar(SymbolTable& symbols)
+        : PrecedenceGrammar::base_type(start)
+    {
+        using qi::_a;
+
+        auto slot_of = phx::bind(&SymbolTable::intern, phx::ref(symbols), qi::_1);
+
+        varname %= qi::alpha >> *qi::alnum;
+
+        start = (varname >> '=' >> expr)
+            [qi::_val = phx::new_<AssignmentNode>(slot_of, qi::_2) ] |
+            expr [qi::_val = qi::_1];
+
+        // one loop over operands and operators, _a is the PrecedenceStack.
+        // The stack is only modified after an operator and its operand were
+        // both parsed successfully.
+        expr = operand [phx::bind(&PrecedenceStack::push_operand, _a, qi::_1)]
+            >> *((qi::char_("-+*/^") >> operand)
+                 [phx::bind(&PrecedenceStack::push_operator, _a, qi::_1),
+                  phx::bind(&PrecedenceStack::push_operand, _a, qi::_2)])
+            >> qi::eps [qi::_val = phx::bind(&PrecedenceStack::finish, _a)];
+
+        // operands may have prefix minus signs, they are counted in _a.
+        operand = (*qi::lit('-') [++_a] >> primary)
+            [qi::_val = phx::construct<PrecedenceStack::Operand>(_a, qi::_1)];
+
+        primary = ('(' >> expr >> ')') [qi::_val = qi::_1] |
+            varname [qi::_val = phx::new_<VariableNode>(slot_of) ] |
+            qi::int_ [qi::_val = phx::new_<ConstantNode>(qi::_1) ];
+    }
+
+    //! name and attach all rules to a profiler (--profile)
+    void profile(RuleProfiler& profiler)
+    {
+        varname.name("varname"), profiler.profile(varname);
+        start.name("start"), profiler.profile(start);
+        expr.name("expr"), profiler.profile(expr);
+        operand.name("operand"), profiler.profile(operand);
+        primary.name("primary"), profiler.profile(primary);
+    }
+
+    qi::rule<Iterator, std::string(), qi::space_type> varname;
+    qi::rule<Iterator, ASTNodePtr(), qi::space_type> start, primary;
+    qi::rule<Iterator, ASTNodePtr(), qi::locals<PrecedenceStack>,
+             qi::space_type> expr;
+    qi::rule<Iterator, PrecedenceStack::Operand(), qi::locals<size_t>,
+             qi::space_type> operand;
+};
+
+/******************************************************************************/
+// Parse-once, evaluate-many: a LRU cache from the formula text to its compiled
+// AST. Repeated formulas skip parsing and go directly to evaluation. The ASTs
+// are held by shared_ptr, hence evicting a formula does not invalidate the
+// ASTs which are still in use.
+
+class FormulaCache
+{
+public:
+    using ASTNodeSPtr = std::shared_ptr<ASTNode>;
+
+    explicit FormulaCache(size_t capacity)
+        : capacity_(capacity) { }
+
+    // return the cached AST of the text, or call compile(text) and cache it.
+    template <typename Compile>
+    ASTNodeSPtr get(const std::string& text, Compile compile) {
+        auto it = map_.find(text);
+        if (it != map_.end()) {
+            // move entry to front of the LRU list
+            lru_.splice(lru_.begin(), lru_, it->second);
+            ++hits_;
+            return it->second->second;
+        }
+        ++misses_;
+        ASTNodeSPtr node = compile(text);
+        if (capacity_ == 0)
+            return node;
+        if (map_.size() >= capacity_) {
+            map_.erase(lru_.back().first);
+            lru_.pop_back();
+            ++evictions_;
+        }
+        lru_.emplace_front(text, node);
+        map_.emplace(text, lru_.begin());
+        return node;
+    }
+
+    void set_capacity(size_t capacity) {
+        capacity_ = capacity;
+        while (map_.size() > capacity_) {
+            map_.erase(lru_.back().first);
+            lru_.pop_back();
+            ++evictions_;
+        }
+    }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+    size_t evictions() const { return evictions_; }
+
+    friend std::ostream& operator << (std::ostream& os, const FormulaCache& c) {
+        return os << "[FormulaCache"
+                  << " size=" << c.map_.size()
+                  << " capacity=" << c.capacity_
+                  << " hits=" << c.hits_
+                  << " misses=" << c.misses_
+                  << " evictions=" << c.evictions_
+                  << "]";
+    }
+
+private:
+    using Entry = std::pair<std::string, ASTNodeSPtr>;
+
+    size_t capacity_;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> map_;
+
+    size_t hits_ = 0, misses_ = 0, evictions_ = 0;
+};
+
+// the symbol table and the variable values of the stdin session
+SymbolTable symbol_table;
+EvalContext context;
+FormulaRegistry formula_registry;
+FormulaCache formula_cache(1024);
+
+// use the PrecedenceGrammar instead of ArithmeticGrammar1 (--precedence)
+bool use_precedence_grammar = false;
+
+// compile a formula: use the specialized version or parse and simplify it.
+std::shared_ptr<ASTNode> CompileFormula(const std::string& input)
+{
+    // specialized formulas skip parsing entirely
+    ASTNode* out_node = formula_registry.lookup(input, symbol_table);
+    if (!out_node) {
+        try {
+            if (use_precedence_grammar)
+                PhraseParseOrDie(input, PrecedenceGrammar(symbol_table),
+                                 qi::space, out_node);
+            else
+                PhraseParseOrDie(input, ArithmeticGrammar1(symbol_table),
+                                 qi::space, out_node);
+        }
+        catch (...) {
+            delete out_node;
+            throw;
+        }
+        if (!out_node)
+            throw std::runtime_error("Parse error");
+        out_node = out_node->simplify();
+    }
+    return std::shared_ptr<ASTNode>(out_node);
+}
+
 void test1(std::string input)
 {
     try {
-        ASTNode* out_node;
-        PhraseParseOrDie(input, ArithmeticGrammar1(), qi::space, out_node);
+        std::shared_ptr<ASTNode> node = formula_cache.get(input, CompileFormula);
+
+        // new variables start with value zero
+        context.resize(symbol_table.size());
 
-        std::cout << "evaluate() = " << out_node->evaluate() << std::endl;
-        delete out_node;
+        std::cout << "evaluate() = " << node->evaluate(context) << std::endl;
     }
     catch (std::exception& e) {
         std::cout << "EXCEPTION: " << e.what() << std::endl;
@@ -163,19 +870,241 @@ void test1(std::string input)
 }
 
 /******************************************************************************/
+// Parallel evaluation of a batch of expressions on a pool of threads. All
+// threads share the base context read-only: each thread works on a private
+// copy, which is reset to the base before each expression, hence assignments
+// do not leak between expressions and the results are deterministic.
 
-int main()
+std::vector<double> EvaluateParallel(
+    const std::vector<std::shared_ptr<ASTNode> >& nodes, const EvalContext& base,
+    size_t num_threads)
 {
-    // important variables
-    variable_map["x"] = 42;
+    std::vector<double> results(nodes.size());
+    std::atomic<size_t> next(0);
 
-    std::cout << "Reading stdin" << std::endl;
+    auto worker = [&]() {
+        EvalContext ctx = base;
+        size_t i;
+        while ((i = next++) < nodes.size()) {
+            if (!nodes[i]) continue;
+            // copy assignment reuses the vector's memory
+            ctx = base;
+            results[i] = nodes[i]->evaluate(ctx);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+
+    return results;
+}
+
+void test2_parallel(std::istream& input, size_t num_threads)
+{
+    // parse all lines first, this also interns all variable names
+    std::vector<std::shared_ptr<ASTNode> > nodes;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::shared_ptr<ASTNode> node;
+        try {
+            node = formula_cache.get(line, CompileFormula);
+        }
+        catch (std::exception& e) {
+            std::cout << "EXCEPTION: " << e.what() << std::endl;
+        }
+        nodes.push_back(node);
+    }
+    context.resize(symbol_table.size());
+
+    std::vector<double> results = EvaluateParallel(nodes, context, num_threads);
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i]) continue;
+        std::cout << "evaluate() = " << results[i] << std::endl;
+    }
+}
 
+// print specialization code for each formula read, after the same
+// simplification which CompileFormula() applies
+void test3_emit(std::istream& input)
+{
     std::string line;
-    while (std::getline(std::cin, line)) {
-        test1(line);
+    while (std::getline(input, line)) {
+        try {
+            ASTNode* out_node = nullptr;
+            PhraseParseOrDie(line, ArithmeticGrammar1(symbol_table), qi::space,
+                             out_node);
+            if (!out_node)
+                throw std::runtime_error("Parse error");
+            out_node = out_node->simplify();
+            EmitFormula(std::cout, line, *out_node, symbol_table);
+            delete out_node;
+        }
+        catch (std::exception& e) {
+            std::cout << "EXCEPTION: " << e.what() << std::endl;
+        }
+    }
+}
+
+/******************************************************************************/
+// Benchmark ArithmeticGrammar1 against the PrecedenceGrammar on long generated
+// expressions with + and * and some parentheses. Prints RESULT lines.
+
+template <typename Grammar>
+void BenchmarkGrammar(const char* name, const std::string& input,
+                      size_t terms, size_t depth, size_t reps)
+{
+    // construct the grammar once, outside the timing loop
+    Grammar g(symbol_table);
+    context.resize(symbol_table.size());
+
+    RunBenchmark(
+        "arithmetic_eval", std::string("spirit6_") + name,
+        input, terms, depth, reps,
+        [&](const std::string& input) {
+            ASTNode* out_node = nullptr;
+            PhraseParseOrDie(input, g, qi::space, out_node);
+            double result = out_node->evaluate(context);
+            delete out_node;
+            return result;
+        });
+}
+
+void test4_benchmark()
+{
+    // some terms of the generated expressions are the variable x, which is
+    // bound in the symbol table before the grammars intern it
+    size_t x = symbol_table.intern("x");
+    context.resize(symbol_table.size());
+    context[x] = 42;
+
+    RunExpressionBenchmarks(
+        "spirit6_ast",
+        [](const std::string& input, size_t terms, size_t depth, size_t reps) {
+            BenchmarkGrammar<ArithmeticGrammar1>(
+                "ArithmeticGrammar1", input, terms, depth, reps);
+            BenchmarkGrammar<PrecedenceGrammar>(
+                "PrecedenceGrammar", input, terms, depth, reps);
+        },
+        /* variables */ true);
+}
+
+/******************************************************************************/
+// Profile the rules of the selected grammar while parsing each line of input.
+// Prints a table sorted by self time and writes folded stacks to
+// spirit6_ast.folded, which flamegraph.pl turns into a flamegraph.
+
+template <typename Grammar>
+void ProfileGrammar(std::istream& input)
+{
+    Grammar g(symbol_table);
+    RuleProfiler profiler;
+    g.profile(profiler);
+
+    std::string line;
+    while (std::getline(input, line)) {
+        try {
+            ASTNode* out_node = nullptr;
+            PhraseParseOrDie(line, g, qi::space, out_node);
+            delete out_node;
+        }
+        catch (std::exception& e) {
+            std::cout << "EXCEPTION: " << e.what() << std::endl;
+        }
+    }
+
+    profiler.print_table(std::cout);
+    std::ofstream folded("spirit6_ast.folded");
+    profiler.write_folded(folded);
+}
+
+void test5_profile(std::istream& input)
+{
+    if (use_precedence_grammar)
+        ProfileGrammar<PrecedenceGrammar>(input);
+    else
+        ProfileGrammar<ArithmeticGrammar1>(input);
+}
+
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    // important variables
+    size_t x = symbol_table.intern("x");
+    context.resize(symbol_table.size());
+    context[x] = 42;
+
+    // options may be given in any order, a plain number is the thread count
+    // of the batch mode.
+    bool emit = false, bench = false, profile = false;
+    size_t num_threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--emit") {
+            // print expression template types of formulas for specialization
+            emit = true;
+        }
+        else if (arg == "--bench") {
+            bench = true;
+        }
+        else if (arg == "--specialized") {
+            // evaluate the example formulas with their expression templates
+            RegisterFormulas(formula_registry);
+        }
+        else if (arg == "--precedence") {
+            // also enables - / ^ and unary minus
+            use_precedence_grammar = true;
+        }
+        else if (arg == "--profile") {
+            // per-rule profile of the parser, no evaluation
+            profile = true;
+        }
+        else if (arg == "--cache-size" && i + 1 < argc) {
+            formula_cache.set_capacity(std::stoul(argv[++i]));
+        }
+        else if (!arg.empty() && std::isdigit(static_cast<unsigned char>(arg[0]))) {
+            num_threads = std::stoul(arg);
+        }
+        else {
+            std::cerr << "Unknown argument " << std::quoted(arg) << std::endl;
+            return 1;
+        }
+    }
+
+    if (emit) {
+        test3_emit(std::cin);
+        return 0;
+    }
+
+    if (bench) {
+        test4_benchmark();
+        return 0;
+    }
+
+    if (profile) {
+        test5_profile(std::cin);
+        return 0;
+    }
+
+    std::cout << "Reading stdin" << std::endl;
+    if (num_threads != 0) {
+        // batch mode: evaluate independent expressions on multiple threads
+        test2_parallel(std::cin, num_threads);
+    }
+    else {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            test1(line);
+        }
     }
 
+    std::cout << formula_cache << std::endl;
     return 0;
 }
 
@@ -1,791 +1,45 @@
 // Example how to use Boost Spirit to parse a HTML-like markup language with
 // Markdown elements and enable additional instructions. This example was
-// extracted from a HTML template engine, but only the AST printer is included.
+// extracted from a HTML template engine. Besides the AST printer, it contains
+// an HTML renderer (--html) and an evaluator of the template directives with
+// C++ functions (--eval).
 //
 // This example is designed to read "example.html".
+//
+// The AST types and grammar are declared in spirit7_html.hpp and defined in
+// spirit7_html_grammar.cpp.
 
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <iomanip>
-#include <stdexcept>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-#include <boost/spirit/include/qi.hpp>
-#include <boost/spirit/include/phoenix.hpp>
-#include <boost/variant/recursive_variant.hpp>
-#include <boost/fusion/include/adapt_struct.hpp>
-
-namespace qi = boost::spirit::qi;
-namespace phx = boost::phoenix;
-namespace ascii = boost::spirit::ascii;
-
-/******************************************************************************/
-// AST node structs
-
-struct ast_null;
-struct ast_comment;
-struct ast_nodelist;
-
-struct ast_func_variable;
-struct ast_func_string;
-struct ast_func_integer;
-struct ast_func_double;
-struct ast_func_call;
-struct ast_func_filter;
-struct ast_func_set;
-struct ast_func_if;
-struct ast_func_for;
-struct ast_func_expr;
-struct ast_func_template;
-
-struct ast_tagged_node;
-struct ast_html_node;
-struct ast_html_selfnode;
-struct ast_highlight;
-
-// boost variant representing an AST node
-
-typedef boost::variant<
-    ast_null,
-    std::string,
-    ast_comment,
-    boost::recursive_wrapper<ast_nodelist>,
-    ast_func_variable,
-    ast_func_string,
-    ast_func_integer,
-    ast_func_double,
-    ast_func_template,
-    boost::recursive_wrapper<ast_func_call>,
-    boost::recursive_wrapper<ast_func_filter>,
-    boost::recursive_wrapper<ast_func_set>,
-    boost::recursive_wrapper<ast_func_if>,
-    boost::recursive_wrapper<ast_func_for>,
-    boost::recursive_wrapper<ast_func_expr>,
-    boost::recursive_wrapper<ast_tagged_node>,
-    boost::recursive_wrapper<ast_html_node>,
-    boost::recursive_wrapper<ast_html_selfnode>,
-    ast_highlight
-    >
-ast_node;
-
-// *** Individual AST node structs
-
-//! represent null or undefined
-struct ast_null
-{
-};
-
-//! a comment <# clause #>
-struct ast_comment : public std::string
-{
-};
-
-//! a sequence of multiple AST nodes
-struct ast_nodelist : public std::vector<ast_node>
-{
-};
-
-//! MyFunc node representing a variable
-struct ast_func_variable : public std::string
-{
-};
-
-//! MyFunc node representing a literal string
-struct ast_func_string : public std::string
-{
-};
-
-//! MyFunc node representing a template name
-struct ast_func_template : public std::string
-{
-};
-
-//! MyFunc node representing a literal integer
-struct ast_func_integer
-{
-    long long   value;
-
-    explicit inline ast_func_integer(const long long& v=0)
-        : value(v) {}
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_integer,
-    (long long, value)
-)
-
-//! MyFunc node representing a literal double
-struct ast_func_double
-{
-    double      value;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_double,
-    (double, value)
-)
-
-//! tagged sequence of multiple AST nodes with HTML attributes, like <p [attr]> [nodes] </p>
-struct ast_highlight
-{
-    std::string                 language;
-    std::string                 content;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_highlight,
-    (std::string, language)
-    (std::string, content)
-)
-
-//! MyFunc node representing a function call with argument list
-struct ast_func_call
-{
-    std::string         funcname;
-    ast_nodelist        args;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_call,
-    (std::string, funcname)
-    (ast_nodelist, args)
-)
-
-//! MyFunc node representing a conditional clause
-struct ast_func_filter
-{
-    ast_node            node;
-    std::string         content;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_filter,
-    (ast_node, node)
-    (std::string, content)
-)
-
-//! MyFunc node representing a function call with argument list and filter content
-struct ast_func_set
-{
-    std::string         varname;
-    ast_node            value;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_set,
-    (std::string, varname)
-    (ast_node, value)
-)
-
-//! MyFunc node representing a function call with argument list and filter content
-struct ast_func_if
-{
-    ast_node            condition, iftrue, iffalse;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_if,
-    (ast_node, condition)
-    (ast_node, iftrue)
-    (ast_node, iffalse)
-)
-
-//! MyFunc node representing a function call with argument list and filter content
-struct ast_func_for
-{
-    std::string         varname;
-    ast_node            arg;
-    ast_node            subtree;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_func_for,
-    (std::string, varname)
-    (ast_node, arg)
-    (ast_node, subtree)
-)
-
-//! MyFunc node representing a sequence of expressions with operators intermingled
-struct ast_func_expr : public ast_nodelist
-{
-};
-
-//! tagged sequence of multiple AST nodes like <p> [nodes] </p>
-struct ast_tagged_node
-{
-    std::string         tag;
-    ast_node            subtree;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_tagged_node,
-    (std::string, tag)
-    (ast_node, subtree)
-)
-
-//! key-value attributes for HTML like name=value
-struct ast_html_attr
-{
-    std::string         name;
-    ast_node            value;
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_html_attr,
-    (std::string, name)
-    (ast_node, value)
-)
-
-//! a sequence of multiple key-value attributes for HTML
-struct ast_html_attrlist : public std::vector<ast_html_attr>
-{
-    const ast_html_attr& find(const std::string& key) const
-    {
-        for (const_iterator it = begin(); it != end(); ++it)
-        {
-            if (it->name != key) continue;
-            return *it;
-        }
-        std::cout << "{ERROR cannot find HTML attribute " << key << "}"
-                  << std::endl;
-        abort();
-    }
-};
-
-//! tagged sequence of multiple AST nodes with HTML attributes, like <p [attr]> [nodes] </p>
-struct ast_html_node
-{
-    std::string         tag;
-    ast_html_attrlist   attrlist;
-    ast_node            subtree;
-
-    ast_html_node() {}
-
-    ast_html_node(const std::string& _tag, const ast_html_attr& attr, const ast_node& _subtree)
-        : tag(_tag), subtree(_subtree)
-    {
-        attrlist.push_back(attr);
-    }
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_html_node,
-    (std::string, tag)
-    (ast_html_attrlist, attrlist)
-    (ast_node, subtree)
-)
-
-//! tagged sequence of multiple AST nodes with HTML attributes, like <img [attr] />
-struct ast_html_selfnode
-{
-    std::string         tag;
-    ast_html_attrlist   attrlist;
-
-    ast_html_selfnode() {}
-
-    ast_html_selfnode(const std::string& _tag, const ast_html_attr& attr1)
-        : tag(_tag)
-    {
-        attrlist.push_back(attr1);
-    }
-
-    ast_html_selfnode(const std::string& _tag, const ast_html_attr& attr1,
-                      const ast_html_attr& attr2)
-        : tag(_tag)
-    {
-        attrlist.push_back(attr1);
-        attrlist.push_back(attr2);
-    }
-};
-
-BOOST_FUSION_ADAPT_STRUCT(
-    ast_html_selfnode,
-    (std::string, tag)
-    (ast_html_attrlist, attrlist)
-)
-
-/******************************************************************************/
-// MyMarkup parser
-
-struct MyMarkupParser : qi::grammar<std::string::const_iterator, ast_node()>
-{
-    typedef std::string::const_iterator Iterator;
-
-    // *** General Base Character Parsers
-
-    qi::rule<Iterator, std::string()> HtmlText, SpecialChar, PlainText;
-
-    qi::rule<Iterator> BlankLine, Indent;
-
-    // *** Inline Blocks with Special Formatting
-
-    qi::rule<Iterator, ast_node()> Inline, InlinePlain;
-
-    qi::rule<Iterator, ast_comment()> Comment, CommentBlock;
-
-    qi::rule<Iterator, ast_tagged_node()> Code, Emph, Strong;
-    qi::rule<Iterator, ast_nodelist()> CodeBlock, EmphBlock, StrongBlock;
-
-    qi::rule<Iterator, ast_html_node()> MarkLink;
-    qi::rule<Iterator, ast_nodelist()> MarkLinkText, MarkLinkRefList;
-    qi::rule<Iterator, ast_html_attr()> MarkLinkRef;
-
-    qi::rule<Iterator, ast_html_selfnode()> MarkImage;
-    qi::rule<Iterator, ast_html_attr()> MarkImageAlt, MarkImageSrc;
-
-    qi::rule<Iterator, ast_html_selfnode()> MarkDownload;
-    qi::rule<Iterator, ast_html_attr()> MarkDownloadRef;
-
-    qi::rule<Iterator, std::string()> HttpLink, SelfLink;
-
-    qi::rule<Iterator, ast_node()> FuncBlock, FuncInline;
-    qi::rule<Iterator, ast_func_filter()> FilterBlock, FilterInline;
-    qi::rule<Iterator, std::string()> VerbatimBlock, VerbatimInline;
-
-    // *** Inline HTML blocks
-
-    qi::rule<Iterator, std::string()> HtmlTagName, HtmlComment;
-
-    qi::rule<Iterator, ast_node()> HtmlPhrase;
-    qi::rule<Iterator, ast_html_node()> HtmlTagBlock;
-    qi::rule<Iterator, ast_html_selfnode()> HtmlTagSelfClose;
-    qi::rule<Iterator, ast_nodelist()> HtmlInline;
-
-    qi::rule<Iterator, ast_html_attr()> HtmlAttribute;
-    qi::rule<Iterator, ast_nodelist()> HtmlQuoted;
-    qi::rule<Iterator, std::string()> HtmlQuotedText;
-
-    // *** Paragraph Blocks: Enumerations
-
-    qi::rule<Iterator> Bullet, Enumet;
-
-    qi::rule<Iterator, ast_tagged_node()> BulletList0, BulletList1, BulletList2;
-    qi::rule<Iterator, ast_tagged_node()> OrderedList0, OrderedList1, OrderedList2;
-
-    qi::rule<Iterator, ast_nodelist()> List0, List1, List2;
-
-    qi::rule<Iterator, ast_tagged_node()> ListItem0, ListItem1, ListItem2;
-
-    qi::rule<Iterator, ast_nodelist()> ListBlock0, ListBlock1, ListBlock2;
-    qi::rule<Iterator, ast_nodelist()> ListBlockLine0, ListBlockLine1, ListBlockLine2;
-
-    qi::rule<Iterator, ast_nodelist()> Line;
-
-    // *** Paragraph Blocks: Headers
-
-    qi::rule<Iterator, ast_tagged_node()> Header, Header1, Header2, Header3, Header4, Header5, Header6;
-
-    qi::rule<Iterator, ast_nodelist()> HeaderA;
-    qi::rule<Iterator, std::string()> HeaderAnchor;
-
-    qi::rule<Iterator, ast_tagged_node()> Header1A, Header2A, Header3A, Header4A, Header5A, Header6A;
-
-    // *** Source Highlighting Code Blocks
-
-    qi::rule<Iterator, ast_highlight()> HighlightBlock;
-
-    // *** Paragraph Blocks: Paragraphs and Plain
-
-    qi::rule<Iterator, ast_tagged_node()> Paragraph;
-    qi::rule<Iterator, ast_nodelist()> ParagraphBlock;
-
-    qi::rule<Iterator, ast_nodelist()> InlineList;
-
-    qi::rule<Iterator, ast_node()> Block;
-
-    qi::rule<Iterator, ast_nodelist()> BlockList;
-
-    qi::rule<Iterator, ast_node()> Start;
-
-    // *** Inline Procedural Language
-
-    typedef qi::space_type Skip;
-
-    qi::rule<Iterator, std::string()> FIdentifier;
-    qi::rule<Iterator, ast_func_variable(), Skip> FVariable;
-    qi::rule<Iterator, ast_func_string()> FString;
-    qi::rule<Iterator, ast_func_double(), Skip> FDouble;
-    qi::rule<Iterator, ast_func_integer(), Skip> FInteger;
-    qi::rule<Iterator, ast_func_call(), Skip> FCall;
-    qi::rule<Iterator, ast_node(), Skip> FBracket;
-
-    qi::rule<Iterator, ast_node(), Skip> FAtomic;
-    qi::rule<Iterator, ast_func_expr(), Skip> FExpr;
-
-    qi::rule<Iterator, ast_func_set(), Skip> FSetClause;
-    qi::rule<Iterator, ast_func_if(), Skip> FIfClause, FEvalIfClause;
-    qi::rule<Iterator, ast_func_for(), Skip> FForClause;
-    qi::rule<Iterator, ast_func_call(), Skip> FInclude;
-
-    qi::rule<Iterator, ast_node(), Skip> FClause;
-
-    qi::rule<Iterator, ast_func_variable(), Skip> FFilterSetClause;
-    qi::rule<Iterator, ast_func_template(), Skip> FFilterTemplateClause;
-    qi::rule<Iterator, ast_node(), Skip> FFilterClause;
-
-    // *** Construction
-
-    MyMarkupParser();
-
-    static const MyMarkupParser& get(); // get singleton
-};
-
-MyMarkupParser::MyMarkupParser() : base_type(Start, "MyMarkupParser")
-{
-    using namespace boost::spirit::ascii;
-    using namespace qi::labels;
-
-    using qi::lit;
-    using qi::eoi;
-    using qi::eol;
-    using qi::attr;
-    using qi::omit;
-    using qi::as_string;
-
-    // ********************************************************************
-    // *** General Base Character Parsers
-
-    // text is composed of non-special characters
-    HtmlText =      +( char_("A-Za-z0-9~@$^.,:;_=+({}|?/-") [ _val += _1 ]
-                       | lit('&')     [ _val += "&amp;" ]
-                       | lit('"')     [ _val += "&quot;" ]
-                       | lit('\'')    [ _val += "&apos;" ]
-                       | lit('>')     [ _val += "&gt;" ]
-                       | lit('\304')  [ _val += "&Auml;" ]
-                       | lit('\326')  [ _val += "&Ouml;" ]
-                       | lit('\334')  [ _val += "&Uuml;" ]
-                       | lit('\337')  [ _val += "&szlig;" ]
-                       | lit('\344')  [ _val += "&auml;" ]
-                       | lit('\350')  [ _val += "&egrave;" ]
-                       | lit('\351')  [ _val += "&eacute;" ]
-                       | lit('\366')  [ _val += "&ouml;" ]
-                       | lit('\374')  [ _val += "&uuml;" ]
-                       | (+blank >> -(eol >> *blank >> !eol)) [ _val += " " ]
-                       | (eol >> *blank >> !eol) [ _val += " " ]
-        );
-
-    // special characters, accepted if no special meaning
-    SpecialChar =   ( char_("*`#[])!") [ _val += _1 ]
-                      //| (lit('<') >> !lit("%")) [ _val += "&lt;" ]
-                      | lit("\\\\")   [ _val += '\\' ]
-                      | lit("\\\"")   [ _val += '"' ]
-                      | lit("\\&")    [ _val += '&' ]
-                      | lit("\\*")    [ _val += '*' ]
-                      | lit("\\#")    [ _val += '#' ]
-                      | lit("\\`")    [ _val += '`' ]
-                      | lit("\\[")    [ _val += '[' ]
-                      | lit("\\<")    [ _val += "&lt;" ]
-                      | (lit('%') >> !lit('%')) [ _val += '%' ]
-        );
-
-    // a blank file
-    BlankLine =     *blank >> eol;
-
-    // identation for lists
-    Indent =        lit('\t') | lit("  ");
-
-    // ********************************************************************
-    // *** Inline Blocks with Special Formatting
-
-    Inline %=       Comment | VerbatimInline | FilterInline | FuncInline | Code | Strong | Emph | SelfLink | MarkDownload | MarkLink | MarkImage | HtmlPhrase | HtmlText | SpecialChar;
-
-    InlinePlain %=  Comment | VerbatimInline | FilterInline | FuncInline | PlainText;
-
-    // inline comments
-
-    Comment %=      "<%#" >> *(!lit("%>") >> char_) >> "%>";
-
-    CommentBlock %= "<%#" >> *(!lit("%>") >> char_) >> "%>" >> omit[*eol];
-
-    // inline styling blocks
-
-    Code %=         '`' >> attr("code") >> CodeBlock >> '`';
-    CodeBlock %=    +(!lit('`') >> Inline);
-
-    Emph %=         '*' >> attr("i") >> EmphBlock >> '*';
-    EmphBlock %=    +(!lit('*') >> Inline);
-
-    Strong %=       "**" >> attr("b") >> StrongBlock >> "**";
-    StrongBlock %=  +(!lit("**") >> Inline);
-
-    // markdown inline links
-
-    MarkLink =      ('[' >> MarkLinkText >> "](" >> MarkLinkRef >> ')')
-        [ _val = phx::construct<ast_html_node>(std::string("markdown-a"), _2, _1) ];
-
-    MarkLinkText %= +(!lit(']') >> Inline);
-    MarkLinkRef %=  attr("href") >> MarkLinkRefList;
-    MarkLinkRefList %= +(!lit(')') >> Inline);
-
-    // markdown inline images
-
-    MarkImage =     ("![" >> MarkImageAlt >> "](" >> MarkImageSrc >> ')')
-        [ _val = phx::construct<ast_html_selfnode>(std::string("markdown-img"), _1, _2) ];
-
-    MarkImageAlt %= attr("alt") >> MarkLinkText;
-    MarkImageSrc %= attr("src") >> MarkLinkRefList;
-
-    // markdown download/view links
-
-    MarkDownload =  "[[" >>
-        MarkDownloadRef [ _val = phx::construct<ast_html_selfnode>(std::string("markdown-download"), _1) ] >>
-        "]]";
-
-    MarkDownloadRef %= attr("href") >> as_string[ +~char_(']') ];
-
-    // self-link inline
-
-    HttpLink %=     string("http") >> +~char_('>');
-
-    SelfLink =      &lit("<http") >> '<' >> HttpLink
-        [ _val = "<a href=\"" + _1 + "\">" + _1 + "</a>" ]  >> '>';
-
-    // inline functional language
-
-    FuncBlock %=    "<%" >> qi::skip(qi::space)[FClause] >> omit[*space] >> "%>" >> omit[eol];
-
-    FuncInline %=   "<%" >> qi::skip(qi::space)[FClause] >> omit[*space] >> "%>";
-
-    FilterBlock %=  "<%|" >> qi::skip(qi::space)[FFilterClause] >> omit[*space] >> "%>" >> omit[eol]
-                          >> *(!(eol >> "<%|%>") >> char_)
-                          >> omit[eol] >> "<%|%>";
-
-    FilterInline %= "<%|" >> qi::skip(qi::space)[FFilterClause] >> omit[*space] >> "%>" >> omit[-eol]
-                          >> *(!(-eol >> "<%|%>") >> char_)
-                          >> omit[-eol] >> "<%|%>";
-
-    VerbatimBlock %= "<%$" >> omit[eol] >> *(!lit("%>") >> char_) >> "%>" >> omit[eol];
-
-    VerbatimInline %= "<%$" >> *(!lit("%>") >> char_) >> "%>";
-
-    // ********************************************************************
-    // *** Inline HTML blocks
-
-    HtmlTagName =
-        string("big") |
-        string("br") |
-        string("button") |
-        string("caption") |
-        string("code") |
-        string("col") |
-        string("dd") |
-        string("div") |
-        string("dl") |
-        string("dt") |
-        string("em") |
-        string("form") |
-        string("h1") | string("h2") | string("h3") | string("h4") | string("h5") | string("h6") |
-        string("hr") |
-        string("iframe") |
-        string("img") |
-        string("input") |
-        string("li") |
-        string("longversion") |
-        string("object") |
-        string("ol") |
-        string("option") |
-        string("param") |
-        string("pre") |
-        string("select") |
-        string("script") |
-        string("span") |
-        string("strong") |
-        string("sup") |
-        string("table") |
-        string("tbody") |
-        string("td") |
-        string("textarea") |
-        string("tfoot") |
-        string("thead") |
-        string("tr") |
-        string("tt") |
-        string("ul") |
-        // two letter overlap
-        string("th") |
-        // one letter matches
-        string("a") | string("b") | string("i") | string("p")
-        ;
-
-    HtmlPhrase %=   &lit('<') >> ( HtmlTagBlock | HtmlComment | HtmlTagSelfClose );
-
-    HtmlTagBlock %= '<' >> HtmlTagName [phx::at_c<0>(_val) = qi::_1]
-                        >> *HtmlAttribute >> omit[*space] >> '>' >> omit[*eol]
-                        >> HtmlInline
-                        >> omit["</" > string(phx::at_c<0>(_val)) >> '>']
-                        >> omit[*eol];
-
-    HtmlInline %=   *( Inline >> omit[*eol] );
-
-    HtmlTagSelfClose %= '<' >> HtmlTagName
-                            >> *HtmlAttribute >> omit[*space] >> "/>"
-                            >> omit[*eol];
-
-    HtmlComment %=  string("<!--") >> *(!lit("-->") >> char_) >> string("-->") >> omit[*eol];
-
-    HtmlAttribute %= omit[+space] >> +(alnum | char_('-')) >> omit[*space >> '=' >> *space] >> HtmlQuoted;
-
-    HtmlQuotedText = +( char_("A-Za-z0-9~!@#$%^.,:;_=+*()[]{}>'|?/ -") [ _val += _1 ]
-                        | (lit('<') >> !lit('%')) [ _val += '<' ]
-                        | lit('&')      [ _val += "&amp;" ]
-                        | lit('\304')   [ _val += "&Auml;" ]
-                        | lit('\326')   [ _val += "&Ouml;" ]
-                        | lit('\334')   [ _val += "&Uuml;" ]
-                        | lit('\337')   [ _val += "&szlig;" ]
-                        | lit('\344')   [ _val += "&auml;" ]
-                        | lit('\350')   [ _val += "&egrave;" ]
-                        | lit('\351')   [ _val += "&eacute;" ]
-                        | lit('\366')   [ _val += "&ouml;" ]
-                        | lit('\374')   [ _val += "&uuml;" ]
-                        | lit("\\\"")   [ _val += '"' ]
-        );
-
-    HtmlQuoted %=   '"' >> *(!lit('"') >> (Comment | FuncInline | HtmlQuotedText)) >> '"';
-
-    qi::on_error<qi::fail>(
-        HtmlTagBlock,
-        std::cout << phx::val("{debug error expecting ") << _4 << phx::val(" here: \"")
-        << phx::construct<std::string>(_3, _2)   // iterators to error-pos, end
-        << phx::val("\"}") << std::endl
-        );
-
-    // ********************************************************************
-    // *** Paragraph Blocks: Enumerations
-
-    Bullet =          char_("+*-") >> +blank;
-    Enumet =          +digit >> '.' >> +blank;
-
-    BulletList0 %=    &Bullet >> attr("ul") >> List0;
-    OrderedList0 %=   &Enumet >> attr("ol") >> List0;
-
-    BulletList1 %=    &(Indent >> Bullet) >> attr("ul") >> List1;
-    OrderedList1 %=   &(Indent >> Enumet) >> attr("ol") >> List1;
-
-    BulletList2 %=    &(Indent >> Indent >> Bullet) >> attr("ul") >> List2;
-    OrderedList2 %=   &(Indent >> Indent >> Enumet) >> attr("ol") >> List2;
-
-    List0 %=          +ListItem0;
-    List1 %=          +ListItem1;
-    List2 %=          +ListItem2;
-
-    ListItem0 %=      omit[(Bullet | Enumet)] >> attr("li") >> ListBlock0;
-    ListItem1 %=      omit[Indent >> (Bullet | Enumet)] >> attr("li") >> ListBlock1;
-    ListItem2 %=      omit[Indent >> Indent >> (Bullet | Enumet)] >> attr("li") >> ListBlock2;
-
-    ListBlock0 %=     !BlankLine >> Line >> *( BulletList1 | OrderedList1 | ListBlockLine0 );
-    ListBlock1 %=     !BlankLine >> Line >> *( BulletList2 | OrderedList2 | ListBlockLine1 );
-    ListBlock2 %=     !BlankLine >> Line >> *( ListBlockLine2 );
-
-    ListBlockLine0 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
-                                 >> Indent >> attr(" ") >> Line;
-
-    ListBlockLine1 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
-                                 >> Indent >> Indent >> attr(" ") >> Line;
-
-    ListBlockLine2 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
-                                 >> Indent >> Indent >> Indent >> attr(" ") >> Line;
-
-    // inline will gobble single eols, but stop at double eols.
-    Line %=           +Inline >> omit[(eol >> BlankLine) | (*eol >> eoi)];
-
-    // ********************************************************************
-    // *** Paragraph Blocks: Headers
-
-    Header6 %=        "###### " >> attr("h6") >> InlineList;
-    Header5 %=        "##### "  >> attr("h5") >> InlineList;
-    Header4 %=        "#### "   >> attr("h4") >> InlineList;
-    Header3 %=        "### "    >> attr("h3") >> InlineList;
-    Header2 %=        "## "     >> attr("h2") >> InlineList;
-    Header1 %=        "# "      >> attr("h1") >> InlineList;
-
-    HeaderAnchor =    as_string[ +~char_(')') ]
-        [ _val = "<a id=\"" + _1 + "\"></a>" ];
-
-    HeaderA %=        HeaderAnchor >> lit(") ") >> InlineList;
-
-    Header6A %=       "######(" >> attr("h6") >> HeaderA;
-    Header5A %=       "#####("  >> attr("h5") >> HeaderA;
-    Header4A %=       "####("   >> attr("h4") >> HeaderA;
-    Header3A %=       "###("    >> attr("h3") >> HeaderA;
-    Header2A %=       "##("     >> attr("h2") >> HeaderA;
-    Header1A %=       "#("      >> attr("h1") >> HeaderA;
-
-    Header %=         &lit('#') >> ( Header6A | Header5A | Header4A | Header3A | Header2A | Header1A |
-                                     Header6 | Header5 | Header4 | Header3 | Header2 | Header1 );
-
-    // ********************************************************************
-    // *** Source Highlighting Code Blocks
-
-    HighlightBlock %= "```" >> omit[*blank] >> *print >> omit[eol]
-                            >> *(!(eol >> "```") >> char_)
-                            >> omit[eol] >> "```" >> omit[*blank >> eol];
-
-    // ********************************************************************
-    // *** Paragraph Blocks: Paragraphs and Plain
-
-    Paragraph %=    attr("p") >> ParagraphBlock >> omit[+(eol | blank >> eoi)];
-    ParagraphBlock %= InlineList;
-
-    InlineList %=   +Inline;
-
-    Block %=        omit[*BlankLine] >> (
-        CommentBlock |
-        VerbatimBlock | FilterBlock | FuncBlock |
-        HighlightBlock |
-        Header |
-        BulletList0 | OrderedList0 |
-        HtmlPhrase |
-        Paragraph | InlineList );
-
-    BlockList %=    *Block;
-
-    Start %=        BlockList;
-
-    // ********************************************************************
-    // *** Inline Procedural Language
-
-    FIdentifier %=  char_("A-Za-z_") >> *char_("A-Za-z0-9_");
-
-    FVariable %=    FIdentifier;
-
-    FString %=      '"' >> *(!lit('"') >> ((lit("\\\"") >> attr('"')) | char_)) >> '"';
-
-    FDouble %=      qi::real_parser< double, qi::strict_real_policies<double> >();
-
-    FInteger %=     qi::long_long;
-
-    FCall %=        FIdentifier >> '(' >> -(FExpr % ',') >> ')';
-
-    FBracket %=     '(' >> FExpr >> ')';
-
-    FAtomic %=      FBracket | FCall | FString | FDouble | FInteger | FVariable;
-
-    FExpr %=        FAtomic % as_string[char_("+")] [ phx::push_back(_val,_1) ];
-
-    FSetClause %=   -lit("SET") >> FIdentifier >> '=' >> FExpr;
-
-    FIfClause %=    "IF" >> FExpr >> "%%" >> Start >> "%%"
-                         >> -(lit("ELSE") >> "%%" >> Start >> "%%")
-                         >> "ENDIF";
-
-    FEvalIfClause %= "EVALIF" >> FExpr >> "%%" >> FClause >> "%%"
-                              >> -(lit("ELSE") >> "%%" >> FClause >> "%%")
-                              >> "ENDIF";
-
-    FForClause %=   "FOR" >> FIdentifier >> '=' >> FExpr >> "%%" >> Start >> "%%"
-                          >> "ENDFOR";
-
-    FInclude %=     "INCLUDE" >> attr("include") >> FIdentifier;
-
-    FClause %=      FSetClause | FEvalIfClause | FIfClause | FForClause | FInclude | FExpr;
-
-    FFilterSetClause %= "SET" >> FIdentifier;
-
-    FFilterTemplateClause %= "TEMPLATE" >> FIdentifier;
+#include <sys/stat.h>
 
-    FFilterClause %= FFilterSetClause | FFilterTemplateClause | FCall;
+#include <boost/spirit/include/qi.hpp>
 
-    // ********************************************************************
-}
+#include "spirit7_html.hpp"
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "rule_profiler.hpp"
 
 /******************************************************************************/
 // Interpret a boost::variant<> object by recursively visiting the nodes inside.
@@ -816,6 +70,11 @@ struct ast_debug : boost::static_visitor<>
         oss << tab() << "text: \"" << text << '"' << std::endl;
     }
 
+    void operator()(const ast_span& text)
+    {
+        oss << tab() << "text: \"" << text << '"' << std::endl;
+    }
+
     void operator()(const ast_comment& text)
     {
         oss << tab() << "comment: \"" << text << '"' << std::endl;
@@ -845,13 +104,13 @@ struct ast_debug : boost::static_visitor<>
 
     void operator()(const ast_tagged_node& ast)
     {
-        oss << tab() << '<' << ast.tag << '>' << std::endl;
+        oss << tab() << '<' << html_tag_name(ast.tag) << '>' << std::endl;
         recurse(ast.subtree);
     }
 
     void operator()(const ast_html_node& ast)
     {
-        oss << tab() << '<' << ast.tag << '>';
+        oss << tab() << '<' << html_tag_name(ast.tag) << '>';
         if (ast.attrlist.size())
         {
             ++depth;
@@ -871,7 +130,7 @@ struct ast_debug : boost::static_visitor<>
 
     void operator()(const ast_html_selfnode& ast)
     {
-        oss << tab() << '<' << ast.tag << '>';
+        oss << tab() << '<' << html_tag_name(ast.tag) << '>';
         if (ast.attrlist.size())
         {
             ++depth;
@@ -968,64 +227,2063 @@ struct ast_debug : boost::static_visitor<>
 };
 
 /******************************************************************************/
+// Render the AST as HTML into a single std::string buffer. ast_html_size first
+// computes the output size, which is used to reserve the buffer, such that
+// ast_html appends without reallocation. Text nodes are already escaped by the
+// grammar, except for double quotes in attribute values. Only the source code
+// of highlight blocks needs full escaping. Template directives are not
+// evaluated and produce no output.
+
+//! HTML escape sequence of a character in text, or nullptr
+inline const char* html_escape(char c)
+{
+    switch (c) {
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '"': return "&quot;";
+    default: return nullptr;
+    }
+}
 
-ast_node parse_markup(const std::string& input, const std::string& name)
+//! the size of a string after escaping with html_escape()
+inline size_t html_escaped_size(boost::string_view s)
 {
-    std::string::const_iterator
-        begin = input.begin(), end = input.end();
+    size_t size = s.size();
+    for (char c : s) {
+        if (const char* e = html_escape(c))
+            size += std::strlen(e) - 1;
+    }
+    return size;
+}
 
-    static const MyMarkupParser p;
-    ast_node ast;
-    bool r = phrase_parse(begin, end, p, qi::space, ast);
+//! the size of an attribute value after escaping double quotes as &quot;
+inline size_t html_attr_size(boost::string_view s)
+{
+    return s.size() + 5 * std::count(s.begin(), s.end(), '"');
+}
+
+//! whether a tag is a block element, which is followed by a newline
+inline bool html_is_block(html_tag_id tag)
+{
+    switch (tag) {
+    case html_tag_id::p: case html_tag_id::ul: case html_tag_id::ol:
+    case html_tag_id::li: case html_tag_id::div: case html_tag_id::table:
+    case html_tag_id::h1: case html_tag_id::h2: case html_tag_id::h3:
+    case html_tag_id::h4: case html_tag_id::h5: case html_tag_id::h6:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//! the HTML tag name of a node, which is "a" or "img" for markdown nodes
+inline boost::string_view html_tag(html_tag_id tag)
+{
+    if (tag == html_tag_id::markdown_a) return "a";
+    if (tag == html_tag_id::markdown_img) return "img";
+    return html_tag_name(tag);
+}
+
+//! computes the exact size of the HTML output of ast_html
+struct ast_html_size : boost::static_visitor<size_t>
+{
+    //! whether strings are inside an attribute value and must be escaped
+    bool in_attr = false;
 
-    if (r && begin == end)
+    size_t recurse(const ast_node& node)
     {
-        std::cout << std::string(80, '-') << std::endl;
-        std::cout << "Parsing " << name << " succeeded." << std::endl;
-        std::cout << std::string(80, '-') << std::endl;
+        return boost::apply_visitor(*this, node);
+    }
 
-        ast_debug prn(ast);
-        std::cout << prn.oss.str();
+    size_t operator()(const ast_null&) { return 0; }
 
-        std::cout << std::string(80, '-') << std::endl;
+    size_t operator()(const std::string& text)
+    {
+        return in_attr ? html_attr_size(text) : text.size();
     }
-    else
+
+    size_t operator()(const ast_span& text)
     {
-        std::cout << std::string(80, '-') << std::endl;
-        std::cout << "Parsing " << name << " failed, stopped at" << std::endl;
-        std::cout << std::string(80, '-') << std::endl;
+        size_t size = 0;
+        text.for_each_piece([&](boost::string_view s) {
+                size += in_attr ? html_attr_size(s) : s.size();
+            });
+        return size;
+    }
 
-        ast_debug prn(ast);
-        std::cout << prn.oss.str();
+    size_t operator()(const ast_nodelist& ast)
+    {
+        size_t size = 0;
+        for (const ast_node& n : ast)
+            size += recurse(n);
+        return size;
+    }
 
-        std::cout << std::string(80, '-') << std::endl;
-        std::cout << "Remaining input" << std::endl;
+    size_t operator()(const ast_tagged_node& ast)
+    {
+        // <tag>subtree</tag>
+        return 2 * html_tag(ast.tag).size() + 5 + recurse(ast.subtree)
+            + html_is_block(ast.tag);
+    }
+
+    size_t attrlist(const ast_html_attrlist& attrlist)
+    {
+        // name="value" with a preceding space
+        size_t size = 0;
+        in_attr = true;
+        for (const ast_html_attr& attr : attrlist)
+            size += attr.name.size() + 4 + recurse(attr.value);
+        in_attr = false;
+        return size;
+    }
 
-        std::cout << std::string(begin,end) << std::endl;
+    size_t operator()(const ast_html_node& ast)
+    {
+        return 2 * html_tag(ast.tag).size() + 5 + attrlist(ast.attrlist)
+            + recurse(ast.subtree) + html_is_block(ast.tag);
+    }
 
-        std::cout << std::string(80, '-') << std::endl;
-        std::cout << "!!! " << name << " parsing FAILED!" << std::endl;
+    size_t operator()(const ast_html_selfnode& ast)
+    {
+        if (ast.tag == html_tag_id::markdown_download) {
+            // <a class="download" href="ref">ref</a>
+            in_attr = true;
+            size_t ref = recurse(ast.attrlist.find("href").value);
+            in_attr = false;
+            return 32 + 2 * ref;
+        }
+        // <tag attributes />
+        return html_tag(ast.tag).size() + 4 + attrlist(ast.attrlist);
     }
 
-    return ast;
-}
+    size_t operator()(const ast_highlight& ast)
+    {
+        // <pre><code class="language-lang">content</code></pre>\n
+        return 43 + html_escaped_size(ast.language)
+            + html_escaped_size(ast.content.text());
+    }
 
-/******************************************************************************/
+    // comments and template directives produce no output
+    template <typename Node>
+    size_t operator()(const Node&) { return 0; }
+};
 
-int main(int argc, char* argv[])
+//! appends the HTML of an AST to a string buffer. The Derived visitor handles
+//! comments and template directives.
+template <typename Derived>
+struct ast_html_base : boost::static_visitor<>
 {
-    if (argc >= 2) {
-        std::ifstream in(argv[1]);
-        std::string input((std::istreambuf_iterator<char>(in)),
-                          std::istreambuf_iterator<char>());
-        parse_markup(input, argv[1]);
+    std::string& out;
+
+    //! whether strings are inside an attribute value and must be escaped
+    bool in_attr = false;
+
+    explicit ast_html_base(std::string& _out) : out(_out) { }
+
+    template <size_t Size>
+    void put(const char (&literal)[Size])
+    {
+        out.append(literal, Size - 1);
+    }
+
+    void put(boost::string_view s)
+    {
+        out.append(s.data(), s.size());
+    }
+
+    void put_escaped(boost::string_view s)
+    {
+        // append runs of characters which need no escaping in one go
+        const char* run = s.data();
+        for (const char* p = s.data(); p != s.data() + s.size(); ++p) {
+            if (const char* e = html_escape(*p)) {
+                out.append(run, p - run);
+                out.append(e);
+                run = p + 1;
+            }
+        }
+        out.append(run, s.data() + s.size() - run);
+    }
+
+    void put_attr(boost::string_view s)
+    {
+        const char* run = s.data();
+        for (const char* p = s.data(); p != s.data() + s.size(); ++p) {
+            if (*p == '"') {
+                out.append(run, p - run);
+                put("&quot;");
+                run = p + 1;
+            }
+        }
+        out.append(run, s.data() + s.size() - run);
+    }
+
+    void recurse(const ast_node& node)
+    {
+        static_cast<Derived&>(*this).visit(node);
+    }
+
+    //! dispatch a node to Derived's operators, which may override this
+    void visit(const ast_node& node)
+    {
+        boost::apply_visitor(static_cast<Derived&>(*this), node);
+    }
+
+    void operator()(const ast_null&) { }
+
+    void operator()(const std::string& text)
+    {
+        if (in_attr)
+            put_attr(text);
+        else
+            put(text);
+    }
+
+    void operator()(const ast_span& text)
+    {
+        text.for_each_piece([&](boost::string_view s) {
+                if (in_attr)
+                    put_attr(s);
+                else
+                    put(s);
+            });
+    }
+
+    void operator()(const ast_nodelist& ast)
+    {
+        for (const ast_node& n : ast)
+            recurse(n);
+    }
+
+    void operator()(const ast_tagged_node& ast)
+    {
+        boost::string_view tag = html_tag(ast.tag);
+        put("<"), put(tag), put(">");
+        recurse(ast.subtree);
+        put("</"), put(tag), put(">");
+        if (html_is_block(ast.tag))
+            put("\n");
+    }
+
+    void attrlist(const ast_html_attrlist& attrlist)
+    {
+        in_attr = true;
+        for (const ast_html_attr& attr : attrlist) {
+            put(" "), put(attr.name), put("=\"");
+            recurse(attr.value);
+            put("\"");
+        }
+        in_attr = false;
+    }
+
+    void operator()(const ast_html_node& ast)
+    {
+        boost::string_view tag = html_tag(ast.tag);
+        put("<"), put(tag);
+        attrlist(ast.attrlist);
+        put(">");
+        recurse(ast.subtree);
+        put("</"), put(tag), put(">");
+        if (html_is_block(ast.tag))
+            put("\n");
+    }
+
+    void operator()(const ast_html_selfnode& ast)
+    {
+        if (ast.tag == html_tag_id::markdown_download) {
+            const ast_node& ref = ast.attrlist.find("href").value;
+            in_attr = true;
+            put("<a class=\"download\" href=\"");
+            recurse(ref);
+            put("\">");
+            recurse(ref);
+            put("</a>");
+            in_attr = false;
+            return;
+        }
+        boost::string_view tag = html_tag(ast.tag);
+        put("<"), put(tag);
+        attrlist(ast.attrlist);
+        put(" />");
+    }
+
+    void operator()(const ast_highlight& ast)
+    {
+        put("<pre><code class=\"language-");
+        put_escaped(ast.language);
+        put("\">");
+        put_escaped(ast.content.text());
+        put("</code></pre>\n");
+    }
+};
+
+//! renders an AST without evaluating template directives
+struct ast_html : public ast_html_base<ast_html>
+{
+    using ast_html_base::ast_html_base;
+    using ast_html_base::operator();
+
+    // comments and template directives produce no output
+    template <typename Node>
+    void operator()(const Node&) { }
+};
+
+//! render the AST as HTML into a buffer reserved to the output size
+std::string render_html(const ast_node& ast)
+{
+    ast_html_size size;
+    size_t estimate = boost::apply_visitor(size, ast);
+    std::string out;
+    out.reserve(estimate);
+
+    ast_html html(out);
+    boost::apply_visitor(html, ast);
+    assert(out.size() == estimate);
+    return out;
+}
+
+/******************************************************************************/
+// Template evaluation of the <% ... %> directives. tpl_resolve() walks an AST
+// once, binds each function call to its entry in a tpl_registry, and assigns
+// each variable name a slot. tpl_render then renders the AST like ast_html and
+// evaluates the directives on a flat vector of variable slots, without any
+// lookups by name.
+//
+// Expressions are sums of literals, variables and calls; "+" adds numbers and
+// concatenates strings or lists. SET assigns a variable, IF and EVALIF test
+// the truth of a value, and FOR binds its variable to each element of a list
+// in turn and restores it afterwards. "INCLUDE name" calls the registered
+// function "include" with the string "name". Filters <%| f(args) %> call f
+// with the content appended to the arguments, while <%| SET v %> and <%|
+// TEMPLATE v %> assign the content to the variable v.
+
+//! value of a template expression
+typedef boost::make_recursive_variant<
+    ast_null, long long, double, std::string,
+    std::vector<boost::recursive_variant_> >::type tpl_value;
+
+typedef std::vector<tpl_value> tpl_list;
+
+//! a C++ callable of the template language
+struct tpl_function
+{
+    std::string name;
+    std::function<tpl_value(const tpl_list& args)> call;
+};
+
+//! registry of C++ callables, looked up by name only while resolving
+class tpl_registry
+{
+public:
+    void add(const std::string& name,
+             std::function<tpl_value(const tpl_list& args)> call)
+    {
+        functions_[name] = tpl_function { name, std::move(call) };
+    }
+
+    const tpl_function* find(const std::string& name) const
+    {
+        auto it = functions_.find(name);
+        return it == functions_.end() ? nullptr : &it->second;
+    }
+
+private:
+    //! node-based map, the addresses of the functions are stable
+    std::unordered_map<std::string, tpl_function> functions_;
+};
+
+//! variable names of a template, each is assigned a dense slot
+class tpl_symbols
+{
+public:
+    static const size_t npos = size_t(-1);
+
+    size_t intern(const std::string& name)
+    {
+        auto it = slots_.emplace(name, slots_.size()).first;
+        return it->second;
+    }
+
+    size_t find(const std::string& name) const
+    {
+        auto it = slots_.find(name);
+        return it == slots_.end() ? npos : it->second;
+    }
+
+    size_t size() const { return slots_.size(); }
+
+private:
+    std::unordered_map<std::string, size_t> slots_;
+};
+
+//! is a value true in IF clauses: non-zero, non-empty
+struct tpl_truth : boost::static_visitor<bool>
+{
+    bool operator()(const ast_null&) const { return false; }
+    bool operator()(const long long& v) const { return v != 0; }
+    bool operator()(const double& v) const { return v != 0; }
+    bool operator()(const std::string& v) const { return !v.empty(); }
+    bool operator()(const tpl_list& v) const { return !v.empty(); }
+};
+
+//! appends the text of a value to a string
+struct tpl_append : boost::static_visitor<>
+{
+    std::string& out;
+
+    explicit tpl_append(std::string& _out) : out(_out) { }
+
+    void operator()(const ast_null&) const { }
+
+    void operator()(const long long& v) const
+    {
+        char buffer[32];
+        out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%lld", v));
+    }
+
+    void operator()(const double& v) const
+    {
+        char buffer[32];
+        out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%g", v));
+    }
+
+    void operator()(const std::string& v) const { out.append(v); }
+
+    void operator()(const tpl_list& v) const
+    {
+        for (const tpl_value& x : v)
+            boost::apply_visitor(*this, x);
+    }
+};
+
+//! the "+" operator: adds numbers, concatenates lists, otherwise strings
+struct tpl_add : boost::static_visitor<tpl_value>
+{
+    tpl_value operator()(const long long& a, const long long& b) const
+    {
+        return a + b;
+    }
+
+    tpl_value operator()(const long long& a, const double& b) const
+    {
+        return a + b;
+    }
+
+    tpl_value operator()(const double& a, const long long& b) const
+    {
+        return a + b;
+    }
+
+    tpl_value operator()(const double& a, const double& b) const
+    {
+        return a + b;
+    }
+
+    tpl_value operator()(const tpl_list& a, const tpl_list& b) const
+    {
+        tpl_list r = a;
+        r.insert(r.end(), b.begin(), b.end());
+        return r;
+    }
+
+    template <typename A, typename B>
+    tpl_value operator()(const A& a, const B& b) const
+    {
+        std::string r;
+        tpl_append append(r);
+        append(a), append(b);
+        return r;
+    }
+};
+
+//! resolves function calls and assigns variable slots in an AST
+struct tpl_resolver : boost::static_visitor<>
+{
+    const tpl_registry& registry;
+    tpl_symbols& symbols;
+
+    tpl_resolver(const tpl_registry& _registry, tpl_symbols& _symbols)
+        : registry(_registry), symbols(_symbols) { }
+
+    void recurse(ast_node& node)
+    {
+        boost::apply_visitor(*this, node);
+    }
+
+    void operator()(ast_nodelist& ast)
+    {
+        for (ast_node& n : ast) recurse(n);
+    }
+
+    void operator()(ast_func_expr& ast)
+    {
+        for (ast_node& n : ast) recurse(n);
+    }
+
+    void operator()(ast_tagged_node& ast)
+    {
+        recurse(ast.subtree);
+    }
+
+    void operator()(ast_html_node& ast)
+    {
+        for (ast_html_attr& attr : ast.attrlist) recurse(attr.value);
+        recurse(ast.subtree);
+    }
+
+    void operator()(ast_html_selfnode& ast)
+    {
+        for (ast_html_attr& attr : ast.attrlist) recurse(attr.value);
+    }
+
+    void operator()(ast_func_variable& ast)
+    {
+        ast.slot = symbols.intern(ast);
+    }
+
+    void operator()(ast_func_template& ast)
+    {
+        ast.slot = symbols.intern(ast);
+    }
+
+    void operator()(ast_func_call& ast)
+    {
+        ast.function = registry.find(ast.funcname);
+        if (!ast.function)
+            throw std::runtime_error(
+                      "Unknown template function " + ast.funcname);
+        operator()(ast.args);
+    }
+
+    void operator()(ast_func_filter& ast)
+    {
+        recurse(ast.node);
+    }
+
+    void operator()(ast_func_set& ast)
+    {
+        ast.slot = symbols.intern(ast.varname);
+        recurse(ast.value);
+    }
+
+    void operator()(ast_func_if& ast)
+    {
+        recurse(ast.condition);
+        recurse(ast.iftrue);
+        recurse(ast.iffalse);
+    }
+
+    void operator()(ast_func_for& ast)
+    {
+        ast.slot = symbols.intern(ast.varname);
+        recurse(ast.arg);
+        recurse(ast.subtree);
+    }
+
+    // text, comments, literals and highlight blocks
+    template <typename Node>
+    void operator()(Node&) { }
+};
+
+//! resolve the functions and variables of an AST once before rendering it
+void tpl_resolve(ast_node& ast, const tpl_registry& registry,
+                 tpl_symbols& symbols)
+{
+    tpl_resolver resolver(registry, symbols);
+    boost::apply_visitor(resolver, ast);
+}
+
+//! evaluates the expressions of a resolved AST
+struct tpl_eval : boost::static_visitor<tpl_value>
+{
+    std::vector<tpl_value>& slots;
+
+    explicit tpl_eval(std::vector<tpl_value>& _slots) : slots(_slots) { }
+
+    tpl_value operator()(const std::string& text) const { return text; }
+
+    tpl_value operator()(const ast_span& text) const { return text.str(); }
+
+    tpl_value operator()(const ast_func_string& ast) const
+    {
+        return ast.str();
+    }
+
+    tpl_value operator()(const ast_func_integer& ast) const
+    {
+        return ast.value;
+    }
+
+    tpl_value operator()(const ast_func_double& ast) const
+    {
+        return ast.value;
+    }
+
+    tpl_value operator()(const ast_func_variable& ast) const
+    {
+        return slots[ast.slot];
+    }
+
+    tpl_value operator()(const ast_func_call& ast) const
+    {
+        tpl_list args;
+        args.reserve(ast.args.size());
+        for (const ast_node& n : ast.args)
+            args.push_back(boost::apply_visitor(*this, n));
+        return ast.function->call(args);
+    }
+
+    tpl_value operator()(const ast_func_expr& ast) const
+    {
+        // operands alternate with the "+" operators
+        tpl_value r = boost::apply_visitor(*this, ast[0]);
+        for (size_t i = 2; i < ast.size(); i += 2)
+            r = boost::apply_visitor(
+                tpl_add(), r, boost::apply_visitor(*this, ast[i]));
+        return r;
+    }
+
+    // all other nodes are not expressions
+    template <typename Node>
+    tpl_value operator()(const Node&) const { return ast_null(); }
+};
+
+//! runs the body of a FOR clause for each element of its range
+template <typename Body>
+void tpl_for_each(const ast_func_for& ast, const tpl_value& range,
+                  std::vector<tpl_value>& slots, Body body)
+{
+    tpl_value saved = std::move(slots[ast.slot]);
+
+    if (const tpl_list* list = boost::get<tpl_list>(&range)) {
+        for (const tpl_value& v : *list) {
+            slots[ast.slot] = v;
+            body();
+        }
+    }
+    else if (boost::apply_visitor(tpl_truth(), range)) {
+        // a single value is iterated once
+        slots[ast.slot] = range;
+        body();
+    }
+
+    slots[ast.slot] = std::move(saved);
+}
+
+//! renders a resolved AST as HTML and evaluates its directives
+struct tpl_render : public ast_html_base<tpl_render>
+{
+    using ast_html_base::operator();
+
+    //! variable values indexed by slot
+    std::vector<tpl_value>& slots;
+
+    tpl_render(std::string& out, std::vector<tpl_value>& _slots)
+        : ast_html_base(out), slots(_slots) { }
+
+    tpl_value eval(const ast_node& node)
+    {
+        return boost::apply_visitor(tpl_eval(slots), node);
+    }
+
+    void put_value(const tpl_value& v)
+    {
+        if (!in_attr)
+            return boost::apply_visitor(tpl_append(out), v);
+
+        std::string text;
+        boost::apply_visitor(tpl_append(text), v);
+        put_attr(text);
+    }
+
+    void operator()(const ast_comment&) { }
+
+    // expressions output their value
+    void operator()(const ast_func_variable& ast) { put_value(eval(ast)); }
+    void operator()(const ast_func_string& ast) { put_value(eval(ast)); }
+    void operator()(const ast_func_integer& ast) { put_value(eval(ast)); }
+    void operator()(const ast_func_double& ast) { put_value(eval(ast)); }
+    void operator()(const ast_func_call& ast) { put_value(eval(ast)); }
+    void operator()(const ast_func_expr& ast) { put_value(eval(ast)); }
+
+    void operator()(const ast_func_template&) { }
+
+    void operator()(const ast_func_set& ast)
+    {
+        slots[ast.slot] = eval(ast.value);
+    }
+
+    void operator()(const ast_func_if& ast)
+    {
+        if (boost::apply_visitor(tpl_truth(), eval(ast.condition)))
+            recurse(ast.iftrue);
+        else
+            recurse(ast.iffalse);
+    }
+
+    void operator()(const ast_func_for& ast)
+    {
+        tpl_for_each(ast, eval(ast.arg), slots,
+                     [&]() { recurse(ast.subtree); });
+    }
+
+    void operator()(const ast_func_filter& ast)
+    {
+        if (const ast_func_variable* v = boost::get<ast_func_variable>(&ast.node))
+            slots[v->slot] = ast.content.str();
+        else if (const ast_func_template* t = boost::get<ast_func_template>(&ast.node))
+            slots[t->slot] = ast.content.str();
+        else if (const ast_func_call* c = boost::get<ast_func_call>(&ast.node)) {
+            tpl_list args;
+            for (const ast_node& n : c->args)
+                args.push_back(eval(n));
+            args.push_back(ast.content.str());
+            put_value(c->function->call(args));
+        }
+    }
+};
+
+/******************************************************************************/
+// Lowering of a resolved AST into a flat program: all static HTML is rendered
+// once into one literal buffer, and each block of the program is a list of
+// instructions which copy a span of that buffer or evaluate a directive. IF
+// and FOR clauses refer to sub-blocks, such that their static bodies are also
+// pre-rendered. Rendering is a loop of appends interleaved with the few
+// directive evaluations.
+
+//! is a node a template directive which is evaluated at render time?
+struct tpl_is_dynamic : boost::static_visitor<bool>
+{
+    bool operator()(const ast_null&) const { return false; }
+    bool operator()(const std::string&) const { return false; }
+    bool operator()(const ast_span&) const { return false; }
+    bool operator()(const ast_comment&) const { return false; }
+    bool operator()(const ast_nodelist&) const { return false; }
+    bool operator()(const ast_tagged_node&) const { return false; }
+    bool operator()(const ast_html_node&) const { return false; }
+    bool operator()(const ast_html_selfnode&) const { return false; }
+    bool operator()(const ast_highlight&) const { return false; }
+
+    template <typename Node>
+    bool operator()(const Node&) const { return true; }
+};
+
+//! one instruction of a lowered template
+struct tpl_instr
+{
+    enum op_type { LITERAL, EVAL, IF, FOR };
+
+    op_type op;
+    //! LITERAL: span [a,b) of the literal buffer. IF: blocks a (true) and b
+    //! (false). FOR: body block a.
+    size_t a, b;
+    //! EVAL: the directive, IF: the ast_func_if, FOR: the ast_func_for.
+    const ast_node* node;
+    //! EVAL: whether the value is output inside an attribute
+    bool in_attr;
+};
+
+//! a lowered template, block 0 is the whole template
+struct tpl_program
+{
+    std::string literals;
+    std::vector<std::vector<tpl_instr> > blocks;
+};
+
+//! renders the static HTML into the literal buffer and emits instructions
+struct tpl_lowering : public ast_html_base<tpl_lowering>
+{
+    using ast_html_base::operator();
+
+    tpl_program& program;
+
+    //! block receiving instructions, and start of its pending literal span
+    size_t block = 0, literal_begin = 0;
+
+    explicit tpl_lowering(tpl_program& _program)
+        : ast_html_base(_program.literals), program(_program) { }
+
+    void emit(tpl_instr::op_type op, size_t a, size_t b,
+              const ast_node* node = nullptr)
+    {
+        program.blocks[block].push_back(tpl_instr { op, a, b, node, in_attr });
+    }
+
+    //! emit the pending static HTML as one literal span
+    void flush()
+    {
+        if (out.size() != literal_begin)
+            emit(tpl_instr::LITERAL, literal_begin, out.size());
+        literal_begin = out.size();
+    }
+
+    //! lower a subtree into a new block and return its index
+    size_t lower_block(const ast_node& node)
+    {
+        size_t saved = block;
+        block = program.blocks.size();
+        program.blocks.emplace_back();
+
+        visit(node);
+        flush();
+
+        size_t result = block;
+        block = saved;
+        return result;
+    }
+
+    //! called by ast_html_base::recurse() for every node
+    void visit(const ast_node& node)
+    {
+        if (!boost::apply_visitor(tpl_is_dynamic(), node))
+            return boost::apply_visitor(*this, node);
+
+        flush();
+        if (const ast_func_if* i = boost::get<ast_func_if>(&node)) {
+            size_t iftrue = lower_block(i->iftrue);
+            size_t iffalse = lower_block(i->iffalse);
+            emit(tpl_instr::IF, iftrue, iffalse, &node);
+        }
+        else if (const ast_func_for* f = boost::get<ast_func_for>(&node)) {
+            size_t body = lower_block(f->subtree);
+            emit(tpl_instr::FOR, body, 0, &node);
+        }
+        else {
+            emit(tpl_instr::EVAL, 0, 0, &node);
+        }
+        literal_begin = out.size();
+    }
+
+    void operator()(const ast_comment&) { }
+
+    // directives never get here, they are emitted by visit()
+    template <typename Node>
+    void operator()(const Node&) { }
+};
+
+//! lower a resolved AST into a program
+void tpl_lower(const ast_node& ast, tpl_program& program)
+{
+    program.blocks.emplace_back();
+    tpl_lowering lowering(program);
+    lowering.visit(ast);
+    lowering.flush();
+}
+
+//! runs a block of a lowered template
+void tpl_run(const tpl_program& program, size_t block,
+             std::string& out, std::vector<tpl_value>& slots)
+{
+    for (const tpl_instr& i : program.blocks[block])
+    {
+        switch (i.op)
+        {
+        case tpl_instr::LITERAL:
+            out.append(program.literals.data() + i.a, i.b - i.a);
+            break;
+        case tpl_instr::EVAL: {
+            tpl_render render(out, slots);
+            render.in_attr = i.in_attr;
+            boost::apply_visitor(render, *i.node);
+            break;
+        }
+        case tpl_instr::IF: {
+            const ast_func_if& ast = boost::get<ast_func_if>(*i.node);
+            tpl_value cond = boost::apply_visitor(tpl_eval(slots), ast.condition);
+            tpl_run(program, boost::apply_visitor(tpl_truth(), cond) ? i.a : i.b,
+                    out, slots);
+            break;
+        }
+        case tpl_instr::FOR: {
+            const ast_func_for& ast = boost::get<ast_func_for>(*i.node);
+            tpl_for_each(ast, boost::apply_visitor(tpl_eval(slots), ast.arg),
+                         slots, [&]() { tpl_run(program, i.a, out, slots); });
+            break;
+        }
+        }
+    }
+}
+
+//! a parsed template with resolved functions and variable slots, and its
+//! lowered program. The program points into the AST, hence it is not copyable.
+//! The template keeps the source text, to which the AST's spans refer.
+struct tpl_template
+{
+    std::shared_ptr<const std::string> source;
+    ast_node ast;
+    tpl_symbols symbols;
+    tpl_program program;
+
+    tpl_template(std::shared_ptr<const std::string> _source, ast_node _ast,
+                 const tpl_registry& registry)
+        : source(std::move(_source)), ast(std::move(_ast))
+    {
+        tpl_resolve(ast, registry, symbols);
+        tpl_lower(ast, program);
+    }
+
+    tpl_template(const tpl_template&) = delete;
+    tpl_template& operator = (const tpl_template&) = delete;
+};
+
+//! variable bindings for rendering a template
+class tpl_context
+{
+public:
+    explicit tpl_context(const tpl_template& t)
+        : symbols_(t.symbols), slots_(t.symbols.size()) { }
+
+    //! bind a variable, variables not used by the template are ignored
+    void set(const std::string& name, tpl_value value)
+    {
+        size_t slot = symbols_.find(name);
+        if (slot != tpl_symbols::npos)
+            slots_[slot] = std::move(value);
+    }
+
+    std::vector<tpl_value>& slots() { return slots_; }
+
+private:
+    const tpl_symbols& symbols_;
+    std::vector<tpl_value> slots_;
+};
+
+//! render a template with the variables of the context
+std::string tpl_render_html(const tpl_template& t, tpl_context& ctx)
+{
+    // the static HTML is an estimate of the output
+    std::string out;
+    out.reserve(t.program.literals.size());
+
+    tpl_run(t.program, 0, out, ctx.slots());
+    return out;
+}
+
+/******************************************************************************/
+
+//! print the AST of a parse and, if it failed, the remaining input
+void print_markup_result(const std::string& name, bool ok, const ast_node& ast,
+                         const std::string& remaining)
+{
+    if (ok)
+    {
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << "Parsing " << name << " succeeded." << std::endl;
+        std::cout << std::string(80, '-') << std::endl;
+
+        ast_debug prn(ast);
+        std::cout << prn.oss.str();
+
+        std::cout << std::string(80, '-') << std::endl;
+    }
+    else
+    {
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << "Parsing " << name << " failed, stopped at" << std::endl;
+        std::cout << std::string(80, '-') << std::endl;
+
+        ast_debug prn(ast);
+        std::cout << prn.oss.str();
+
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << "Remaining input" << std::endl;
+
+        std::cout << remaining << std::endl;
+
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << "!!! " << name << " parsing FAILED!" << std::endl;
+    }
+}
+
+ast_node parse_markup(const std::string& input, const std::string& name,
+                      const MyMarkupParser<>& p)
+{
+    ParseStatsScope stats("parse_markup", input.size());
+
+    std::string::const_iterator
+        begin = input.begin(), end = input.end();
+
+    // memoized results refer to positions in the previous input
+    p.Memo.clear();
+
+    ast_node ast;
+    bool r = phrase_parse(begin, end, p, qi::space, ast);
+
+    print_markup_result(name, r && begin == end, ast, std::string(begin, end));
+
+    return ast;
+}
+
+ast_node parse_markup(const std::string& input, const std::string& name)
+{
+    static const MyMarkupParser<> p;
+    return parse_markup(input, name, p);
+}
+
+//! parse the input without printing the AST, failures are reported to stderr
+bool parse_markup_quiet(const std::string& input, const std::string& name,
+                        const MyMarkupParser<>& p, ast_node& ast)
+{
+    std::string::const_iterator
+        begin = input.begin(), end = input.end();
+
+    p.Memo.clear();
+
+    bool r = phrase_parse(begin, end, p, qi::space, ast);
+
+    if (!r || begin != end)
+    {
+        std::cerr << "!!! " << name << " parsing FAILED!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//! run memo_self_test() and check that the input parses to the same AST with
+//! and without memoization, returns false if either check fails.
+bool check_memo(const std::string& input, const std::string& name)
+{
+    bool ok = memo_self_test(std::cout);
+
+    const MyMarkupParser<> plain, memo(true);
+    ast_node plain_ast, memo_ast;
+    bool r1 = parse_markup_quiet(input, name, plain, plain_ast);
+    bool r2 = parse_markup_quiet(input, name, memo, memo_ast);
+
+    bool same = (r1 == r2 &&
+                 ast_debug(plain_ast).oss.str() == ast_debug(memo_ast).oss.str());
+    std::cout << "check_memo: " << name << ": "
+              << (same ? "ok" : "FAILED") << std::endl;
+    return ok && same;
+}
+
+//! parse the input and write its HTML rendering to stdout
+void render_markup(const std::string& input, const std::string& name,
+                   const MyMarkupParser<>& p)
+{
+    ast_node ast;
+    if (!parse_markup_quiet(input, name, p, ast))
+        return;
+
+    std::string html;
+    {
+        ParseStatsScope stats("render_html", input.size());
+        html = render_html(ast);
+    }
+    std::fwrite(html.data(), 1, html.size(), stdout);
+}
+
+//! estimates the heap bytes held by an AST: the boxes of recursive nodes, the
+//! arrays of lists, and the buffers of strings too long for the small string
+//! buffer. Spans hold none, only their input.
+struct ast_heap_size : boost::static_visitor<size_t>
+{
+    static size_t str(const std::string& s)
+    {
+        static const size_t local = std::string().capacity();
+        return s.capacity() > local ? s.capacity() + 1 : 0;
+    }
+
+    size_t recurse(const ast_node& node)
+    {
+        return boost::apply_visitor(*this, node);
+    }
+
+    size_t list(const ast_nodelist& ast)
+    {
+        size_t size = ast.capacity() * sizeof(ast_node);
+        for (const ast_node& n : ast)
+            size += recurse(n);
+        return size;
+    }
+
+    size_t attrlist(const ast_html_attrlist& ast)
+    {
+        size_t size = ast.capacity() * sizeof(ast_html_attr);
+        for (const ast_html_attr& a : ast)
+            size += str(a.name) + recurse(a.value);
+        return size;
+    }
+
+    size_t operator()(const std::string& s) { return str(s); }
+    size_t operator()(const ast_comment& s) { return str(s); }
+    size_t operator()(const ast_func_variable& s) { return str(s); }
+    size_t operator()(const ast_func_string& s) { return str(s); }
+    size_t operator()(const ast_func_template& s) { return str(s); }
+
+    size_t operator()(const ast_nodelist& ast)
+    {
+        return sizeof(ast) + list(ast);
+    }
+
+    size_t operator()(const ast_func_expr& ast)
+    {
+        return sizeof(ast) + list(ast);
+    }
+
+    size_t operator()(const ast_func_call& ast)
+    {
+        return sizeof(ast) + str(ast.funcname) + list(ast.args);
+    }
+
+    size_t operator()(const ast_func_filter& ast)
+    {
+        return sizeof(ast) + recurse(ast.node) + str(ast.content);
+    }
+
+    size_t operator()(const ast_func_set& ast)
+    {
+        return sizeof(ast) + str(ast.varname) + recurse(ast.value);
+    }
+
+    size_t operator()(const ast_func_if& ast)
+    {
+        return sizeof(ast) + recurse(ast.condition) + recurse(ast.iftrue)
+            + recurse(ast.iffalse);
+    }
+
+    size_t operator()(const ast_func_for& ast)
+    {
+        return sizeof(ast) + str(ast.varname) + recurse(ast.arg)
+            + recurse(ast.subtree);
+    }
+
+    size_t operator()(const ast_tagged_node& ast)
+    {
+        return sizeof(ast) + recurse(ast.subtree);
+    }
+
+    size_t operator()(const ast_html_node& ast)
+    {
+        return sizeof(ast) + attrlist(ast.attrlist) + recurse(ast.subtree);
+    }
+
+    size_t operator()(const ast_html_selfnode& ast)
+    {
+        return sizeof(ast) + attrlist(ast.attrlist);
+    }
+
+    size_t operator()(const ast_highlight& ast)
+    {
+        return str(ast.language) + str(ast.content);
+    }
+
+    // spans, numbers and null
+    template <typename Node>
+    size_t operator()(const Node&) { return 0; }
+};
+
+//! parse the input and report the heap bytes held by the AST and the peak RSS
+//! of the process against the input size, to compare parses with and without
+//! spans. The peak RSS includes the program and the input.
+void measure_markup(const std::string& input, const std::string& name,
+                    const MyMarkupParser<>& p)
+{
+    ast_node ast;
+    if (!parse_markup_quiet(input, name, p, ast))
+        return;
+
+    ast_heap_size heap;
+    std::cout << "RESULT benchmark=markup_memory"
+              << " name=" << name
+              << " spans=" << p.UseSpans
+              << " input_bytes=" << input.size()
+              << " ast_bytes=" << boost::apply_visitor(heap, ast)
+              << " peak_rss_kib=" << PeakRSS()
+              << std::endl;
+}
+
+/******************************************************************************/
+// Incremental re-parsing for live previews: a document is kept as the list of
+// its top-level blocks and their source ranges. After an edit, parsing restarts
+// at the block before the edit and stops as soon as a block boundary coincides
+// with the start of an old block behind the edit. The text from there on is
+// unchanged, hence so are all following blocks, which are reused with shifted
+// ranges. The parsing work per edit thus depends on the size of the edited
+// blocks, not on the length of the document.
+//
+// Blocks before the edit are reused as they are. This misses edits which change
+// how an earlier block parses through a failed lookahead, e.g. closing an
+// unterminated "<%#" several blocks above. Call parse() to resynchronize.
+
+//! a top-level block and its source range [begin, end) in the document
+struct markup_block
+{
+    size_t begin, end;
+    ast_node ast;
+};
+
+class markup_document
+{
+public:
+    explicit markup_document(const MyMarkupParser<>& parser)
+        : parser_(parser) { }
+
+    //! parse the whole text
+    void parse(std::string text)
+    {
+        text_ = std::move(text);
+        blocks_.clear();
+
+        // the implied pre-skip of phrase_parse()
+        size_t pos = 0;
+        while (pos < text_.size() && std::isspace((unsigned char)text_[pos]))
+            ++pos;
+
+        reparsed_ = 0;
+        parser_.Memo.clear();
+        finish(parse_blocks(pos, blocks_));
+    }
+
+    //! replace erase characters at pos with insert and re-parse the blocks
+    //! affected by it.
+    void edit(size_t pos, size_t erase, const std::string& insert)
+    {
+        assert(pos + erase <= text_.size());
+        text_.replace(pos, erase, insert);
+
+        ptrdiff_t delta = insert.size() - erase;
+        size_t edit_end = pos + insert.size();
+
+        // first block touching the edit, and the one before it, whose end
+        // depends on the text following it.
+        size_t k = std::lower_bound(
+            blocks_.begin(), blocks_.end(), pos,
+            [](const markup_block& b, size_t pos) { return b.end < pos; })
+            - blocks_.begin();
+        if (k > 0) --k;
+
+        size_t start = 0;
+        if (k == 0) {
+            while (start < text_.size() &&
+                   std::isspace((unsigned char)text_[start]))
+                ++start;
+        }
+        else {
+            start = blocks_[k].begin;
+        }
+
+        // memoized results refer to positions in the previous text
+        parser_.Memo.clear();
+
+        std::vector<markup_block> fresh;
+        size_t cur = start, j = k;
+        reparsed_ = 0;
+
+        while (true)
+        {
+            if (cur >= edit_end) {
+                // does an old block start here behind the edit?
+                size_t old_cur = cur - delta;
+                while (j < blocks_.size() && blocks_[j].begin < old_cur) ++j;
+
+                if (j < blocks_.size() && blocks_[j].begin == old_cur) {
+                    for (size_t i = j; i < blocks_.size(); ++i) {
+                        blocks_[i].begin += delta;
+                        blocks_[i].end += delta;
+                    }
+                    parsed_end_ += delta;
+                    splice(k, j, fresh);
+                    return;
+                }
+            }
+            if (!parse_block(cur, fresh))
+                break;
+        }
+
+        splice(k, blocks_.size(), fresh);
+        finish(cur);
+    }
+
+    //! the current text
+    const std::string& text() const { return text_; }
+
+    //! the top-level blocks
+    const std::vector<markup_block>& blocks() const { return blocks_; }
+
+    //! whether the whole text could be parsed
+    bool ok() const { return ok_; }
+
+    //! number of blocks parsed by the last parse() or edit()
+    size_t reparsed() const { return reparsed_; }
+
+    //! the AST of the whole document, as parse_markup() returns it
+    ast_node ast() const
+    {
+        ast_nodelist list;
+        list.reserve(blocks_.size());
+        for (const markup_block& b : blocks_)
+            list.push_back(b.ast);
+        return list;
+    }
+
+private:
+    //! parse one block at pos, append it and advance pos past it
+    bool parse_block(size_t& pos, std::vector<markup_block>& out)
+    {
+        std::string::const_iterator
+            first = text_.begin() + pos, last = text_.end();
+
+        markup_block b;
+        if (!parser_.parse_block(first, last, b.ast))
+            return false;
+
+        b.begin = pos;
+        b.end = pos = first - text_.begin();
+        out.emplace_back(std::move(b));
+        ++reparsed_;
+        return true;
+    }
+
+    //! parse all blocks from pos on, returns the end of the last one
+    size_t parse_blocks(size_t pos, std::vector<markup_block>& out)
+    {
+        while (parse_block(pos, out)) { }
+        return pos;
+    }
+
+    //! replace the old blocks [first, last) with fresh ones
+    void splice(size_t first, size_t last, std::vector<markup_block>& fresh)
+    {
+        blocks_.erase(blocks_.begin() + first, blocks_.begin() + last);
+        blocks_.insert(blocks_.begin() + first,
+                       std::make_move_iterator(fresh.begin()),
+                       std::make_move_iterator(fresh.end()));
+    }
+
+    //! check that only whitespace follows the last block, like the post-skip
+    //! of phrase_parse().
+    void finish(size_t pos)
+    {
+        parsed_end_ = pos;
+        while (pos < text_.size() && std::isspace((unsigned char)text_[pos]))
+            ++pos;
+        ok_ = (pos == text_.size());
+    }
+
+    //! the parser is not reentrant, it may not be shared across threads
+    const MyMarkupParser<>& parser_;
+
+    std::string text_;
+    std::vector<markup_block> blocks_;
+    size_t parsed_end_ = 0;
+    bool ok_ = false;
+    size_t reparsed_ = 0;
+};
+
+//! apply random single character edits to a document, as typing would, and
+//! compare the incremental re-parse with a full parse of each version.
+void incremental_markup(const std::string& input, const std::string& name,
+                        const MyMarkupParser<>& p, size_t edits)
+{
+    using clock = std::chrono::steady_clock;
+
+    markup_document doc(p);
+    auto t0 = clock::now();
+    doc.parse(input);
+    double full_secs = std::chrono::duration<double>(clock::now() - t0).count();
+
+    std::mt19937 rng(42);
+    static const char typed[] = "x \n*";
+
+    double edit_secs = 0, verify_secs = 0;
+    size_t reparsed = 0, mismatches = 0;
+
+    for (size_t i = 0; i < edits; ++i)
+    {
+        size_t size = doc.text().size();
+        size_t pos = std::uniform_int_distribution<size_t>(0, size)(rng);
+        bool erase = (rng() % 4 == 0 && pos < size);
+        std::string insert(erase ? 0 : 1, typed[rng() % (sizeof(typed) - 1)]);
+
+        auto t1 = clock::now();
+        doc.edit(pos, erase ? 1 : 0, insert);
+        auto t2 = clock::now();
+        edit_secs += std::chrono::duration<double>(t2 - t1).count();
+        reparsed += doc.reparsed();
+
+        // the full parse which the incremental one replaces
+        std::string::const_iterator
+            begin = doc.text().begin(), end = doc.text().end();
+        p.Memo.clear();
+        ast_node full;
+        bool r = phrase_parse(begin, end, p, qi::space, full);
+        verify_secs += std::chrono::duration<double>(clock::now() - t2).count();
+
+        if ((r && begin == end) != doc.ok() ||
+            ast_debug(full).oss.str() != ast_debug(doc.ast()).oss.str())
+        {
+            std::cerr << "!!! " << name << ": incremental parse differs after"
+                      << " edit " << i << " at " << pos << std::endl;
+            ++mismatches;
+        }
+    }
+
+    std::cout << "RESULT benchmark=incremental_parse"
+              << " name=" << name
+              << " size=" << doc.text().size()
+              << " blocks=" << doc.blocks().size()
+              << " edits=" << edits
+              << " parse_us=" << full_secs * 1e6
+              << " full_reparse_us=" << verify_secs / edits * 1e6
+              << " edit_us=" << edit_secs / edits * 1e6
+              << " blocks_per_edit=" << double(reparsed) / edits
+              << " mismatches=" << mismatches
+              << std::endl;
+}
+
+/******************************************************************************/
+// Parallel block-level parsing of large documents: a pre-scan splits the text
+// into chunks at blank lines which are outside of ``` fences, "<% ... %>"
+// directives and "<%| ... <%|%>" filter regions. The chunks are parsed
+// block-wise by a pool of worker threads, each with its own parser since the
+// memo tables and profiler stacks are not shared. The workers parse on the whole text, so lookahead beyond a
+// chunk's end sees the same input as a sequential parse.
+//
+// The results are concatenated in order. A chunk is only used if the blocks
+// before it ended exactly at its start. If a block ran across a chunk start
+// anyway, the merge parses sequentially until it meets the next chunk start,
+// hence the result always equals that of a sequential parse.
+
+//! find chunk starts about size / chunks bytes apart at safe top-level block
+//! boundaries. The first chunk starts after leading whitespace, as after the
+//! pre-skip of phrase_parse().
+std::vector<size_t> markup_split(const std::string& text, size_t chunks)
+{
+    size_t pos = 0;
+    while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+        ++pos;
+
+    std::vector<size_t> starts(1, pos);
+    size_t chunk_size = text.size() / std::max<size_t>(chunks, 1) + 1;
+    size_t next = pos + chunk_size;
+
+    bool fence = false, filter = false, blank = false;
+    size_t directive = 0;
+
+    while (pos < text.size())
+    {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) eol = text.size();
+
+        bool line_blank =
+            text.find_first_not_of(" \t\r", pos) >= eol;
+
+        if (blank && !line_blank && pos >= next &&
+            !fence && !filter && directive == 0) {
+            starts.push_back(pos);
+            next = pos + chunk_size;
+        }
+        blank = line_blank;
+
+        if (text.compare(pos, 3, "```") == 0)
+            fence = !fence;
+        else if (!fence) {
+            for (size_t i = pos; i + 1 < eol; ++i)
+            {
+                if (text.compare(i, 5, "<%|%>") == 0)
+                    filter = false, i += 4;
+                else if (filter)
+                    continue;
+                else if (text.compare(i, 3, "<%|") == 0)
+                    filter = true, i += 2;
+                else if (text.compare(i, 2, "<%") == 0)
+                    ++directive, ++i;
+                else if (text.compare(i, 2, "%>") == 0 && directive != 0)
+                    --directive, ++i;
+            }
+        }
+        pos = eol + 1;
+    }
+    return starts;
+}
+
+//! the blocks parsed by a worker from a chunk start
+struct markup_chunk
+{
+    ast_nodelist blocks;
+    //! position after the last block
+    size_t end;
+    //! whether a block failed before reaching the next chunk
+    bool stopped = false;
+};
+
+//! Worker threads for parse_markup_parallel(). Constructing a parser is more
+//! expensive than parsing a small document, hence the threads and their
+//! parsers are created once and reused for each document. The workers' parsers
+//! are configured like the caller's parser: memoization, spans, and with their
+//! own RuleProfiler if the caller's parser is profiled. With pools, each
+//! worker allocates its AST node boxes from its own ast_pool.
+class markup_parser_pool
+{
+public:
+    using job_type = std::function<void(const MyMarkupParser<>&)>;
+
+    //! the caller's thread is one of the threads and uses parser p
+    markup_parser_pool(const MyMarkupParser<>& p, size_t threads, bool pools)
+        : parser_(p)
+    {
+        for (size_t t = 1; t < threads; ++t)
+        {
+            worker w;
+            if (pools) w.pool.reset(new ast_pool);
+            if (p.Profiler) w.profiler.reset(new RuleProfiler);
+            w.parser.reset(new MyMarkupParser<>(
+                               p.UseMemo, w.profiler.get(), p.UseSpans));
+            workers_.push_back(std::move(w));
+        }
+        for (size_t t = 0; t < workers_.size(); ++t)
+            threads_.emplace_back([this, t]() { loop(workers_[t]); });
+    }
+
+    ~markup_parser_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (std::thread& t : threads_)
+            t.join();
+    }
+
+    //! the caller's parser
+    const MyMarkupParser<>& parser() const { return parser_; }
+
+    size_t threads() const { return workers_.size() + 1; }
+
+    //! run job with each thread's parser, returns after all finished
+    void run(const job_type& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = job;
+            running_ = workers_.size();
+            ++generation_;
+        }
+        start_.notify_all();
+        job(parser_);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return running_ == 0; });
+        job_ = nullptr;
+    }
+
+    //! add the memo and profile statistics of the workers to the caller's
+    //! parser, call once after all runs.
+    void merge_stats() const
+    {
+        for (const worker& w : workers_)
+        {
+            parser_.Memo.merge_stats(w.parser->Memo);
+            if (parser_.Profiler) parser_.Profiler->merge(*w.profiler);
+        }
+    }
+
+    //! print the ast_pool statistics of the workers. Nodes freed by other
+    //! threads are counted as live until the worker reclaims them.
+    void print_pools(std::ostream& os) const
+    {
+        for (const worker& w : workers_)
+            if (w.pool) os << *w.pool << std::endl;
+    }
+
+private:
+    struct worker
+    {
+        //! declared first, the memo tables of the parser hold AST nodes
+        std::unique_ptr<ast_pool> pool;
+        std::unique_ptr<RuleProfiler> profiler;
+        std::unique_ptr<MyMarkupParser<> > parser;
+    };
+
+    const MyMarkupParser<>& parser_;
+    std::vector<worker> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    job_type job_;
+    size_t generation_ = 0, running_ = 0;
+    bool stop_ = false;
+
+    void loop(const worker& w)
+    {
+        std::unique_ptr<ast_pool::scope> pool_scope;
+        if (w.pool) pool_scope.reset(new ast_pool::scope(*w.pool));
+        const MyMarkupParser<>& p = *w.parser;
+        size_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+            // job_ is not modified until all workers are done
+            job_(p);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--running_ == 0) done_.notify_one();
+            }
+        }
+    }
+};
+
+//! parse the input with the pool's threads, returns whether the whole input
+//! was parsed and the position after the last block in end.
+bool parse_markup_parallel(const std::string& input, markup_parser_pool& pool,
+                           ast_node& ast, size_t& end)
+{
+    // a few chunks per thread balance uneven block sizes
+    std::vector<size_t> starts = markup_split(input, pool.threads() * 4);
+    std::vector<markup_chunk> chunks(starts.size());
+    std::atomic<size_t> next_chunk(0);
+
+    pool.run([&](const MyMarkupParser<>& wp) {
+        // the memo tables refer to positions in the previous input
+        wp.Memo.clear();
+        size_t i;
+        while ((i = next_chunk++) < starts.size())
+        {
+            markup_chunk& c = chunks[i];
+            size_t limit = i + 1 < starts.size() ? starts[i + 1] : input.size();
+
+            std::string::const_iterator
+                first = input.begin() + starts[i], last = input.end();
+
+            while (first - input.begin() < (ptrdiff_t)limit) {
+                ast_node block;
+                if (!wp.parse_block(first, last, block)) {
+                    c.stopped = true;
+                    break;
+                }
+                c.blocks.push_back(std::move(block));
+            }
+            c.end = first - input.begin();
+        }
+    });
+
+    // concatenate the chunks, the caller's parser fills in where blocks ran
+    // across a chunk start.
+    const MyMarkupParser<>& p = pool.parser();
+    ast_nodelist list;
+    std::string::const_iterator
+        first = input.begin() + starts[0], last = input.end();
+
+    for (size_t i = 0; ; )
+    {
+        size_t pos = first - input.begin();
+        while (i < starts.size() && starts[i] < pos) ++i;
+
+        if (i < starts.size() && starts[i] == pos) {
+            markup_chunk& c = chunks[i++];
+            std::move(c.blocks.begin(), c.blocks.end(),
+                      std::back_inserter(list));
+            first = input.begin() + c.end;
+            if (c.stopped) break;
+            continue;
+        }
+
+        ast_node block;
+        if (!p.parse_block(first, last, block))
+            break;
+        list.push_back(std::move(block));
+    }
+
+    // the post-skip of phrase_parse()
+    while (first != last && std::isspace((unsigned char)*first))
+        ++first;
+
+    ast = std::move(list);
+    end = first - input.begin();
+    return first == last;
+}
+
+//! parse the input repeat times with the pool and print the AST like
+//! parse_markup(). The RESULT line reports the mean time per parse. The
+//! allocations of the PARSE_STATS report include those of the workers.
+ast_node parse_markup(const std::string& input, const std::string& name,
+                      markup_parser_pool& pool, size_t repeat = 1)
+{
+    ParseStatsScope stats("parse_markup_parallel", input.size());
+
+    auto start = std::chrono::steady_clock::now();
+    ast_node ast;
+    size_t end;
+    bool ok = false;
+    for (size_t r = 0; r < repeat; ++r)
+        ok = parse_markup_parallel(input, pool, ast, end);
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    print_markup_result(name, ok, ast, input.substr(end));
+
+    std::cerr << "RESULT benchmark=parallel_parse"
+              << " name=" << name
+              << " size=" << input.size()
+              << " threads=" << pool.threads()
+              << " repeat=" << repeat
+              << " time=" << seconds / repeat
+              << std::endl;
+    return ast;
+}
+
+/******************************************************************************/
+// Cache of compiled templates: a server renders the same template files many
+// times with different variables, hence each file is parsed and resolved only
+// once. Entries are keyed by path and revalidated by the file's modification
+// time and size; if these changed, the file is read again and only re-parsed
+// if its content differs. The template keeps the source text, which is
+// compared when the hashes are equal, as equal hashes do not prove equal
+// content.
+
+class tpl_cache
+{
+public:
+    tpl_cache(const MyMarkupParser<>& parser, const tpl_registry& registry)
+        : parser_(parser), registry_(registry) { }
+
+    //! get the compiled template of a file, throws if it cannot be parsed
+    std::shared_ptr<const tpl_template> get(const std::string& path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            throw std::runtime_error("Cannot stat template " + path);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        entry& e = map_[path];
+
+        if (e.tpl && e.mtime_sec == st.st_mtim.tv_sec &&
+            e.mtime_nsec == st.st_mtim.tv_nsec && e.size == st.st_size) {
+            ++hits_;
+            return e.tpl;
+        }
+
+        // the text is parsed in place and shared with the template, the spans
+        // of the AST refer to it
+        std::ifstream in(path);
+        auto input = std::make_shared<const std::string>(
+            std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>());
+        size_t hash = std::hash<std::string>()(*input);
+
+        if (e.tpl && e.hash == hash && *e.tpl->source == *input) {
+            // touched, but the content is unchanged
+            e.mtime_sec = st.st_mtim.tv_sec;
+            e.mtime_nsec = st.st_mtim.tv_nsec;
+            ++hits_;
+            return e.tpl;
+        }
+
+        ++misses_;
+        // the entry is only updated once the new template is built, a failed
+        // parse or resolve drops it instead of keeping the stale version
+        ast_node ast;
+        if (!parse_markup_quiet(*input, path, parser_, ast)) {
+            map_.erase(path);
+            throw std::runtime_error("Cannot parse template " + path);
+        }
+        std::shared_ptr<const tpl_template> tpl;
+        try {
+            tpl = std::make_shared<const tpl_template>(
+                std::move(input), std::move(ast), registry_);
+        }
+        catch (...) {
+            map_.erase(path);
+            throw;
+        }
+        // renderers holding the previous version keep it alive
+        e.tpl = std::move(tpl);
+        e.mtime_sec = st.st_mtim.tv_sec;
+        e.mtime_nsec = st.st_mtim.tv_nsec;
+        e.size = st.st_size;
+        e.hash = hash;
+        return e.tpl;
+    }
+
+    //! drop all cached templates
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_.clear();
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const tpl_cache& c)
+    {
+        std::lock_guard<std::mutex> lock(c.mutex_);
+        return os << "[tpl_cache size=" << c.map_.size()
+                  << " hits=" << c.hits_ << " misses=" << c.misses_ << "]";
+    }
+
+private:
+    struct entry
+    {
+        std::shared_ptr<const tpl_template> tpl;
+        time_t mtime_sec = 0;
+        long mtime_nsec = 0;
+        off_t size = 0;
+        //! the hash is compared first, equal hashes are confirmed by the text
+        size_t hash = 0;
+    };
+
+    //! the parser is not reentrant, it is only used under the mutex
+    const MyMarkupParser<>& parser_;
+    const tpl_registry& registry_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, entry> map_;
+    size_t hits_ = 0, misses_ = 0;
+};
+
+/******************************************************************************/
+
+//! some C++ functions for the template directives in examples
+void register_example_functions(tpl_registry& registry)
+{
+    // func(a,b,...) returns its arguments as "func(a,b,...)"
+    registry.add("func", [](const tpl_list& args) -> tpl_value {
+            std::string r = "func(";
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (i != 0) r += ',';
+                boost::apply_visitor(tpl_append(r), args[i]);
+            }
+            return r + ')';
+        });
+    // range(n) returns the list [0, n)
+    registry.add("range", [](const tpl_list& args) -> tpl_value {
+            tpl_list r;
+            const long long* n = args.empty() ? nullptr
+                : boost::get<long long>(&args[0]);
+            for (long long i = 0; n && i < *n; ++i)
+                r.push_back(i);
+            return r;
+        });
+    // upper(s) converts to upper case
+    registry.add("upper", [](const tpl_list& args) -> tpl_value {
+            std::string r;
+            for (const tpl_value& a : args)
+                boost::apply_visitor(tpl_append(r), a);
+            for (char& c : r) c = std::toupper(c);
+            return r;
+        });
+    // INCLUDE name
+    registry.add("include", [](const tpl_list& args) -> tpl_value {
+            std::string r = "<!-- include ";
+            for (const tpl_value& a : args)
+                boost::apply_visitor(tpl_append(r), a);
+            return r + " -->";
+        });
+}
+
+//! render a cached template with variables given as "name=value" bindings
+//! and write the HTML to stdout. With repeat > 1 the template is fetched from
+//! the cache and rendered multiple times, as a server would do.
+void eval_markup(const std::string& path, tpl_cache& cache,
+                 const std::vector<std::string>& bindings, size_t repeat = 1)
+{
+    std::string html;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t r = 0; r < repeat; ++r)
+    {
+        std::shared_ptr<const tpl_template> t;
+        try {
+            t = cache.get(path);
+        }
+        catch (std::exception& e) {
+            std::cerr << "!!! " << path << ": " << e.what() << std::endl;
+            return;
+        }
+        tpl_context ctx(*t);
+
+        for (const std::string& b : bindings) {
+            size_t eq = b.find('=');
+            if (eq == std::string::npos) continue;
+            std::string value = b.substr(eq + 1);
+            // integers are bound as numbers, everything else as strings
+            char* endptr;
+            long long number = std::strtoll(value.c_str(), &endptr, 10);
+            if (!value.empty() && *endptr == 0)
+                ctx.set(b.substr(0, eq), number);
+            else
+                ctx.set(b.substr(0, eq), value);
+        }
+
+        html = tpl_render_html(*t, ctx);
+    }
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::fwrite(html.data(), 1, html.size(), stdout);
+
+    if (repeat > 1) {
+        std::cerr << "RESULT benchmark=tpl_render"
+                  << " path=" << path
+                  << " repeat=" << repeat
+                  << " output_bytes=" << html.size()
+                  << " time=" << seconds
+                  << " us_per_render=" << seconds / repeat * 1e6
+                  << std::endl;
+        std::cerr << cache << std::endl;
+    }
+}
+
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    // options may be given in any order, the other arguments are collected
+    bool memo = false, profile = false, spans = false, html = false;
+    bool eval = false, incremental = false, check = false, pooled = false;
+    bool memory = false;
+    size_t repeat = 1, threads = 0;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        // "--memo" enables packrat memoization and prints its statistics.
+        if (arg == "--memo")
+            memo = true;
+        // "--profile" prints a per-rule profile and writes the call stacks to
+        // spirit7_html.folded for flamegraph.pl.
+        else if (arg == "--profile")
+            profile = true;
+        // "--spans" keeps text which needs no escaping as spans of the input.
+        // The input must outlive the AST, which holds in the AST, --html and
+        // --parallel modes, and for --eval, whose templates keep their text.
+        // --incremental keeps copies: its blocks outlive edits of the text.
+        else if (arg == "--spans")
+            spans = true;
+        // "--html" writes the rendered HTML instead of the AST.
+        else if (arg == "--html")
+            html = true;
+        // "--eval FILE [name=value ...]" also evaluates the template
+        // directives.
+        else if (arg == "--eval")
+            eval = true;
+        // "--eval --repeat N" renders the cached template N times, and
+        // "--parallel N --repeat M" parses the document M times.
+        else if (arg == "--repeat" && i + 1 < argc)
+            repeat = std::stoul(argv[++i]);
+        // "--parallel N" parses the top-level blocks with N threads.
+        else if (arg == "--parallel" && i + 1 < argc)
+            threads = std::stoul(argv[++i]);
+        // "--incremental FILE [N]" applies N random edits and re-parses them.
+        else if (arg == "--incremental")
+            incremental = true;
+        // "--check [FILE]" runs the memoization regression checks.
+        else if (arg == "--check")
+            check = true;
+        // "--memory FILE" reports the memory held by the AST, with "--spans"
+        // or without.
+        else if (arg == "--memory")
+            memory = true;
+        // "--pool" allocates the boxes of recursive AST nodes from an ast_pool
+        // per thread instead of the heap.
+        else if (arg == "--pool")
+            pooled = true;
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << std::quoted(arg) << std::endl;
+            return 1;
+        }
+        else
+            args.push_back(arg);
+    }
+
+    // the pool is declared before the parser, whose memo tables hold nodes
+    ast_pool pool;
+    std::unique_ptr<ast_pool::scope> pool_scope;
+    if (pooled) pool_scope.reset(new ast_pool::scope(pool));
+
+    RuleProfiler profiler;
+    const MyMarkupParser<> p(memo, profile ? &profiler : nullptr,
+                             spans && !incremental);
+
+    if (check) {
+        std::string input;
+        if (!args.empty()) {
+            std::ifstream in(args[0]);
+            input.assign(std::istreambuf_iterator<char>(in),
+                         std::istreambuf_iterator<char>());
+        }
+        return check_memo(input, !args.empty() ? args[0] : "empty") ? 0 : 1;
+    }
+
+    if (eval && !args.empty()) {
+        tpl_registry registry;
+        register_example_functions(registry);
+        tpl_cache cache(p, registry);
+
+        eval_markup(args[0], cache,
+                    std::vector<std::string>(args.begin() + 1, args.end()),
+                    repeat);
+    }
+    else if (incremental && !args.empty()) {
+        std::ifstream in(args[0]);
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        incremental_markup(input, args[0], p,
+                           args.size() >= 2 ? std::stoul(args[1]) : 100);
+    }
+    else if (memory && !args.empty()) {
+        std::ifstream in(args[0]);
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        measure_markup(input, args[0], p);
+    }
+    else if (html) {
+        std::ifstream file;
+        if (!args.empty()) file.open(args[0]);
+        std::istream& in = !args.empty() ? file : std::cin;
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        render_markup(input, !args.empty() ? args[0] : "stdin", p);
+    }
+    else if (threads != 0) {
+        std::ifstream file;
+        if (!args.empty()) file.open(args[0]);
+        else std::cout << "Reading stdin" << std::endl;
+        std::istream& in = !args.empty() ? file : std::cin;
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+
+        // the workers and their parsers are constructed once
+        markup_parser_pool workers(p, threads, pooled);
+        parse_markup(input, !args.empty() ? args[0] : "stdin", workers, repeat);
+        workers.merge_stats();
+        if (pooled && ParseStatsEnabled())
+            workers.print_pools(std::cerr);
+    }
+    else if (!args.empty()) {
+        std::ifstream in(args[0]);
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        parse_markup(input, args[0], p);
     }
     else {
         std::cout << "Reading stdin" << std::endl;
         std::string input((std::istreambuf_iterator<char>(std::cin)),
                           std::istreambuf_iterator<char>());
-        parse_markup(input, "stdin");
+        parse_markup(input, "stdin", p);
+    }
+
+    if (memo)
+        p.Memo.print_stats(std::cout);
+
+    if (profile) {
+        profiler.print_table(std::cout);
+        std::ofstream folded("spirit7_html.folded");
+        profiler.write_folded(folded);
     }
+
+    if (pooled && ParseStatsEnabled())
+        std::cerr << pool << std::endl;
+
     return 0;
 }
 
@@ -0,0 +1,1087 @@
+// Declarations of the HTML-like markup grammar of spirit7_html.cpp: the AST
+// node types and the MyMarkupParser grammar.
+//
+// The grammar's rules are defined in spirit7_html_grammar.cpp, which is the
+// only translation unit instantiating them: MyMarkupParser is explicitly
+// instantiated there for std::string::const_iterator, and declared extern
+// here. Changes to the AST printer or main() hence do not recompile the
+// grammar.
+
+#ifndef SPIRIT7_HTML_HEADER
+#define SPIRIT7_HTML_HEADER
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/spirit/include/qi.hpp>
+#include <boost/utility/string_view.hpp>
+#include <boost/variant/recursive_variant.hpp>
+#include <boost/fusion/include/adapt_struct.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+namespace qi = boost::spirit::qi;
+
+class RuleProfiler;
+struct tpl_function;
+
+/******************************************************************************/
+// Pool for the heap boxes of recursive AST nodes: boost::variant keeps these
+// alternatives behind recursive_wrapper, which allocates a new box on each
+// construction, copy and even move, and Spirit moves attributes between rules
+// many times. While an ast_pool::scope is active on a thread, boxes are taken
+// from the pool's per-size free lists or carved from its chunks, and freed
+// boxes return to the free lists. Without a scope, boxes come from the heap;
+// spirit7_html opens scopes only with "--pool".
+//
+// This is only a faster allocator for the boxes, not an arena: nodes have no
+// stable indices, every node is still destroyed one by one, and Spirit still
+// copies subtrees between rules, only the copies' boxes are recycled. An arena
+// with index-linked nodes would replace recursive_wrapper in the whole AST,
+// the grammar's attributes and all visitors.
+//
+// Each box has a header naming the store of its pool's chunks, hence boxes
+// may be freed on any thread: boxes freed outside of the pool's scope, e.g. by
+// another thread, are pushed onto a lock-free list which the pool's thread
+// reclaims. A pool is in scope on at most one thread at a time. If a pool is
+// destroyed while boxes are alive, its store is kept and released with the
+// last box.
+
+class ast_pool
+{
+public:
+    ast_pool() : store_(new store) { }
+
+    ast_pool(const ast_pool&) = delete;
+    ast_pool& operator = (const ast_pool&) = delete;
+
+    ~ast_pool()
+    {
+        // boxes freed from now on count down the orphans instead
+        store_->orphaned = true;
+        reclaim();
+        size_t left = store_->orphans.fetch_add(live_) + live_;
+        if (left == 0) delete store_;
+    }
+
+    //! allocate the boxes of AST nodes on this thread from a pool
+    class scope
+    {
+    public:
+        explicit scope(ast_pool& pool) : prev_(current()) { current() = &pool; }
+        ~scope() { current() = prev_; }
+
+        scope(const scope&) = delete;
+        scope& operator = (const scope&) = delete;
+
+    private:
+        ast_pool* prev_;
+    };
+
+    //! allocate a box from the current pool, or from the heap without one
+    static void* allocate(size_t size)
+    {
+        ast_pool* pool = current();
+        size_t cls = (sizeof(header) + size + align - 1) / align;
+        header* h;
+        if (pool && cls < classes) {
+            h = pool->take(cls);
+            h->owner = pool->store_;
+            h->cls = cls;
+        }
+        else {
+            h = static_cast<header*>(::operator new(sizeof(header) + size));
+            h->owner = nullptr;
+        }
+        return h + 1;
+    }
+
+    //! free a box to its pool or the heap
+    static void deallocate(void* p)
+    {
+        if (!p) return;
+        header* h = static_cast<header*>(p) - 1;
+        ast_pool* pool = current();
+        if (!h->owner)
+            ::operator delete(h);
+        else if (pool && h->owner == pool->store_)
+            pool->give(h);
+        else
+            give_remote(h);
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const ast_pool& p)
+    {
+        return os << "[ast_pool chunks=" << p.store_->chunks.size()
+                  << " allocs=" << p.allocs_ << " reused=" << p.reused_
+                  << " remote=" << p.remote_frees_
+                  << " live=" << p.live_ << "]";
+    }
+
+private:
+    //! box sizes are multiples of align, up to classes * align bytes
+    static const size_t align = 16, classes = 64, chunk_size = 64 * 1024;
+
+    //! a freed box, next overlays the owner pointer and keeps cls
+    struct free_box
+    {
+        free_box* next;
+    };
+
+    //! the chunks of a pool and the boxes freed outside of its scope
+    struct store
+    {
+        std::vector<char*> chunks;
+        std::atomic<free_box*> remote { nullptr };
+        //! set when the pool is destroyed
+        std::atomic<bool> orphaned { false };
+        //! boxes alive after the pool was destroyed, modulo 2^64
+        std::atomic<size_t> orphans { 0 };
+
+        ~store() { for (char* c : chunks) ::operator delete(c); }
+    };
+
+    struct alignas(16) header
+    {
+        store* owner;
+        size_t cls;
+    };
+
+    static ast_pool*& current()
+    {
+        static thread_local ast_pool* pool = nullptr;
+        return pool;
+    }
+
+    header* take(size_t cls)
+    {
+        ++allocs_, ++live_;
+        if (!free_[cls] && store_->remote.load(std::memory_order_relaxed))
+            reclaim();
+        if (free_box* b = free_[cls]) {
+            free_[cls] = b->next;
+            ++reused_;
+            return reinterpret_cast<header*>(b);
+        }
+        size_t bytes = cls * align;
+        if (left_ < bytes) {
+            pos_ = static_cast<char*>(::operator new(chunk_size));
+            store_->chunks.push_back(pos_);
+            left_ = chunk_size;
+        }
+        header* h = reinterpret_cast<header*>(pos_);
+        pos_ += bytes, left_ -= bytes;
+        return h;
+    }
+
+    void give(header* h)
+    {
+        size_t cls = h->cls;
+        free_box* b = reinterpret_cast<free_box*>(h);
+        b->next = free_[cls];
+        free_[cls] = b;
+        --live_;
+    }
+
+    //! free a box from outside the pool's scope, may run on any thread. Once
+    //! the pool is destroyed, the last box releases the store. A box freed
+    //! while the pool is being destroyed may keep the store alive.
+    static void give_remote(header* h)
+    {
+        store* s = h->owner;
+        if (s->orphaned) {
+            if (s->orphans.fetch_sub(1) == 1) delete s;
+            return;
+        }
+        free_box* b = reinterpret_cast<free_box*>(h);
+        b->next = s->remote.load(std::memory_order_relaxed);
+        while (!s->remote.compare_exchange_weak(
+                   b->next, b, std::memory_order_release,
+                   std::memory_order_relaxed)) { }
+    }
+
+    //! move the boxes freed remotely to the free lists
+    void reclaim()
+    {
+        free_box* b = store_->remote.exchange(nullptr, std::memory_order_acquire);
+        while (b) {
+            free_box* next = b->next;
+            give(reinterpret_cast<header*>(b));
+            ++remote_frees_;
+            b = next;
+        }
+    }
+
+    store* store_;
+    char* pos_ = nullptr;
+    size_t left_ = 0;
+
+    free_box* free_[classes] = { };
+
+    size_t allocs_ = 0, reused_ = 0, remote_frees_ = 0, live_ = 0;
+};
+
+//! base of the recursive AST nodes, whose boxes come from the ast_pool
+struct ast_pooled
+{
+    static void* operator new (size_t size) { return ast_pool::allocate(size); }
+    static void operator delete (void* p) { ast_pool::deallocate(p); }
+};
+
+/******************************************************************************/
+// Tag ids of the AST nodes: the HTML tag names accepted by HtmlTagName, which
+// are matched in one pass by a qi::symbols trie yielding the tag's id, and the
+// pseudo-tags of Markdown links, images and downloads. The AST only stores
+// the id, html_tag_name() is called where a tag is printed.
+
+#define MYMARKUP_HTML_TAGS                                                  \
+    (a)(b)(big)(br)(button)(caption)(code)(col)(dd)(div)(dl)(dt)(em)(form)  \
+    (h1)(h2)(h3)(h4)(h5)(h6)(hr)(i)(iframe)(img)(input)(li)(longversion)    \
+    (object)(ol)(option)(p)(param)(pre)(select)(script)(span)(strong)(sup)  \
+    (table)(tbody)(td)(textarea)(tfoot)(th)(thead)(tr)(tt)(ul)
+
+enum class html_tag_id : unsigned char
+{
+#define MYMARKUP_HTML_TAG_ENUM(r, data, tag) tag,
+    BOOST_PP_SEQ_FOR_EACH(MYMARKUP_HTML_TAG_ENUM, _, MYMARKUP_HTML_TAGS)
+#undef MYMARKUP_HTML_TAG_ENUM
+    markdown_a, markdown_img, markdown_download
+};
+
+//! name of a tag id
+inline const char* html_tag_name(html_tag_id id)
+{
+    static const char* const names[] = {
+#define MYMARKUP_HTML_TAG_NAME(r, data, tag) BOOST_PP_STRINGIZE(tag),
+        BOOST_PP_SEQ_FOR_EACH(MYMARKUP_HTML_TAG_NAME, _, MYMARKUP_HTML_TAGS)
+#undef MYMARKUP_HTML_TAG_NAME
+        "markdown-a", "markdown-img", "markdown-download"
+    };
+    return names[static_cast<size_t>(id)];
+}
+
+/******************************************************************************/
+// AST node structs
+
+struct ast_null;
+struct ast_span;
+struct ast_comment;
+struct ast_nodelist;
+
+struct ast_func_variable;
+struct ast_func_string;
+struct ast_func_integer;
+struct ast_func_double;
+struct ast_func_call;
+struct ast_func_filter;
+struct ast_func_set;
+struct ast_func_if;
+struct ast_func_for;
+struct ast_func_expr;
+struct ast_func_template;
+
+struct ast_tagged_node;
+struct ast_html_node;
+struct ast_html_selfnode;
+struct ast_highlight;
+
+// boost variant representing an AST node
+
+typedef boost::variant<
+    ast_null,
+    std::string,
+    ast_comment,
+    boost::recursive_wrapper<ast_nodelist>,
+    ast_func_variable,
+    ast_func_string,
+    ast_func_integer,
+    ast_func_double,
+    ast_func_template,
+    boost::recursive_wrapper<ast_func_call>,
+    boost::recursive_wrapper<ast_func_filter>,
+    boost::recursive_wrapper<ast_func_set>,
+    boost::recursive_wrapper<ast_func_if>,
+    boost::recursive_wrapper<ast_func_for>,
+    boost::recursive_wrapper<ast_func_expr>,
+    boost::recursive_wrapper<ast_tagged_node>,
+    boost::recursive_wrapper<ast_html_node>,
+    boost::recursive_wrapper<ast_html_selfnode>,
+    ast_highlight,
+    ast_span
+    >
+ast_node;
+
+// *** Individual AST node structs
+
+//! represent null or undefined
+struct ast_null
+{
+};
+
+//! text which needs no escaping, referring to the parsed input. The input
+//! must outlive the AST. The grammar turns runs of whitespace in text into
+//! single spaces, spans with collapse set leave this to their readers.
+struct ast_span
+{
+    boost::string_view source;
+    bool collapse = false;
+
+    ast_span() { }
+    ast_span(boost::string_view _source, bool _collapse)
+        : source(_source), collapse(_collapse) { }
+
+    //! call f with the pieces of the text as boost::string_view
+    template <typename Function>
+    void for_each_piece(Function f) const
+    {
+        if (!collapse) {
+            f(source);
+            return;
+        }
+        const char* p = source.data(), * end = p + source.size();
+        while (p != end) {
+            const char* run = p;
+            while (p != end && !is_space(*p)) ++p;
+            if (p != run) f(boost::string_view(run, p - run));
+            if (p == end) break;
+            while (p != end && is_space(*p)) ++p;
+            f(boost::string_view(" ", 1));
+        }
+    }
+
+    //! append the text to a string
+    void append_to(std::string& out) const
+    {
+        for_each_piece([&](boost::string_view s) {
+                out.append(s.data(), s.size());
+            });
+    }
+
+    std::string str() const
+    {
+        std::string out;
+        append_to(out);
+        return out;
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const ast_span& s)
+    {
+        s.for_each_piece([&](boost::string_view p) { os << p; });
+        return os;
+    }
+
+    static bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+};
+
+//! text which the grammar takes from the input unchanged: the content of
+//! comments, string literals, highlight blocks and filters. With spans, the
+//! text refers to the parsed input and the string itself stays empty, hence
+//! it must be read with text().
+struct ast_source_text : public std::string
+{
+    //! with spans, the text in the input
+    boost::string_view span;
+
+    boost::string_view text() const
+    {
+        return span.data() ? span : boost::string_view(data(), size());
+    }
+
+    std::string str() const
+    {
+        return std::string(text().data(), text().size());
+    }
+
+    friend std::ostream& operator << (std::ostream& os,
+                                      const ast_source_text& t)
+    {
+        return os << t.text();
+    }
+};
+
+//! a comment <# clause #>
+struct ast_comment : public ast_source_text
+{
+};
+
+//! a sequence of multiple AST nodes
+struct ast_nodelist : public std::vector<ast_node>, public ast_pooled
+{
+};
+
+//! MyFunc node representing a variable
+struct ast_func_variable : public std::string
+{
+    //! variable slot, assigned by tpl_resolve()
+    size_t slot = 0;
+};
+
+//! MyFunc node representing a literal string
+struct ast_func_string : public ast_source_text
+{
+};
+
+//! MyFunc node representing a template name
+struct ast_func_template : public std::string
+{
+    //! variable slot, assigned by tpl_resolve()
+    size_t slot = 0;
+};
+
+//! MyFunc node representing a literal integer
+struct ast_func_integer
+{
+    long long   value;
+
+    explicit inline ast_func_integer(const long long& v=0)
+        : value(v) {}
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_integer,
+    (long long, value)
+)
+
+//! MyFunc node representing a literal double
+struct ast_func_double
+{
+    double      value;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_double,
+    (double, value)
+)
+
+//! tagged sequence of multiple AST nodes with HTML attributes, like <p [attr]> [nodes] </p>
+struct ast_highlight
+{
+    std::string                 language;
+    ast_source_text             content;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_highlight,
+    (std::string, language)
+    (ast_source_text, content)
+)
+
+//! MyFunc node representing a function call with argument list
+struct ast_func_call : public ast_pooled
+{
+    std::string         funcname;
+    ast_nodelist        args;
+
+    //! registered function, assigned by tpl_resolve()
+    const tpl_function* function = nullptr;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_call,
+    (std::string, funcname)
+    (ast_nodelist, args)
+)
+
+//! MyFunc node representing a conditional clause
+struct ast_func_filter : public ast_pooled
+{
+    ast_node            node;
+    ast_source_text     content;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_filter,
+    (ast_node, node)
+    (ast_source_text, content)
+)
+
+//! MyFunc node representing a function call with argument list and filter content
+struct ast_func_set : public ast_pooled
+{
+    std::string         varname;
+    ast_node            value;
+
+    //! variable slot, assigned by tpl_resolve()
+    size_t              slot = 0;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_set,
+    (std::string, varname)
+    (ast_node, value)
+)
+
+//! MyFunc node representing a function call with argument list and filter content
+struct ast_func_if : public ast_pooled
+{
+    ast_node            condition, iftrue, iffalse;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_if,
+    (ast_node, condition)
+    (ast_node, iftrue)
+    (ast_node, iffalse)
+)
+
+//! MyFunc node representing a function call with argument list and filter content
+struct ast_func_for : public ast_pooled
+{
+    std::string         varname;
+    ast_node            arg;
+    ast_node            subtree;
+
+    //! variable slot, assigned by tpl_resolve()
+    size_t              slot = 0;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_func_for,
+    (std::string, varname)
+    (ast_node, arg)
+    (ast_node, subtree)
+)
+
+//! MyFunc node representing a sequence of expressions with operators intermingled
+struct ast_func_expr : public ast_nodelist
+{
+};
+
+//! tagged sequence of multiple AST nodes like <p> [nodes] </p>
+struct ast_tagged_node : public ast_pooled
+{
+    html_tag_id         tag;
+    ast_node            subtree;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_tagged_node,
+    (html_tag_id, tag)
+    (ast_node, subtree)
+)
+
+//! key-value attributes for HTML like name=value
+struct ast_html_attr
+{
+    std::string         name;
+    ast_node            value;
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_html_attr,
+    (std::string, name)
+    (ast_node, value)
+)
+
+//! a sequence of multiple key-value attributes for HTML
+struct ast_html_attrlist : public std::vector<ast_html_attr>
+{
+    const ast_html_attr& find(const std::string& key) const
+    {
+        for (const_iterator it = begin(); it != end(); ++it)
+        {
+            if (it->name != key) continue;
+            return *it;
+        }
+        std::cout << "{ERROR cannot find HTML attribute " << key << "}"
+                  << std::endl;
+        abort();
+    }
+};
+
+//! tagged sequence of multiple AST nodes with HTML attributes, like <p [attr]> [nodes] </p>
+struct ast_html_node : public ast_pooled
+{
+    html_tag_id         tag;
+    ast_html_attrlist   attrlist;
+    ast_node            subtree;
+
+    ast_html_node() {}
+
+    ast_html_node(html_tag_id _tag, const ast_html_attr& attr, const ast_node& _subtree)
+        : tag(_tag), subtree(_subtree)
+    {
+        attrlist.push_back(attr);
+    }
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_html_node,
+    (html_tag_id, tag)
+    (ast_html_attrlist, attrlist)
+    (ast_node, subtree)
+)
+
+//! tagged sequence of multiple AST nodes with HTML attributes, like <img [attr] />
+struct ast_html_selfnode : public ast_pooled
+{
+    html_tag_id         tag;
+    ast_html_attrlist   attrlist;
+
+    ast_html_selfnode() {}
+
+    ast_html_selfnode(html_tag_id _tag, const ast_html_attr& attr1)
+        : tag(_tag)
+    {
+        attrlist.push_back(attr1);
+    }
+
+    ast_html_selfnode(html_tag_id _tag, const ast_html_attr& attr1,
+                      const ast_html_attr& attr2)
+        : tag(_tag)
+    {
+        attrlist.push_back(attr1);
+        attrlist.push_back(attr2);
+    }
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    ast_html_selfnode,
+    (html_tag_id, tag)
+    (ast_html_attrlist, attrlist)
+)
+
+/******************************************************************************/
+// Table-driven scanner for HtmlText and HtmlQuotedText. Both accept runs of
+// plain characters, entity escapes and a few special cases. Instead of trying
+// one alternative per character, each byte is classified by a 256-entry table
+// and maximal runs of plain characters are appended to the attribute at once.
+// The scanner does not depend on Spirit: html_text_parser wraps it as a Qi
+// primitive in spirit7_html_grammar.cpp, and spirit9_x3_markup.cpp wraps it
+// as an X3 parser.
+
+//! character classes of html_text_scanner
+enum html_text_class : unsigned char
+{
+    HTC_STOP = 0,       //!< ends the text
+    HTC_PLAIN,          //!< copied verbatim
+    HTC_ENTITY,         //!< replaced by its entity
+    HTC_BLANK,          //!< runs of blanks become one space
+    HTC_EOL,            //!< a line break not followed by an empty line
+    HTC_LT,             //!< '<' unless it opens a "<%" directive
+    HTC_BACKSLASH,      //!< "\"" is an escaped quote
+};
+
+//! classification and entity tables of a text scanner
+struct html_text_table
+{
+    html_text_class cls[256];
+    const char* entity[256];
+
+    explicit html_text_table(const char* plain)
+    {
+        std::fill(cls, cls + 256, HTC_STOP);
+        std::fill(entity, entity + 256, nullptr);
+
+        for (int c = 'A'; c <= 'Z'; ++c) cls[c] = HTC_PLAIN;
+        for (int c = 'a'; c <= 'z'; ++c) cls[c] = HTC_PLAIN;
+        for (int c = '0'; c <= '9'; ++c) cls[c] = HTC_PLAIN;
+        for (const char* p = plain; *p; ++p)
+            cls[(unsigned char)*p] = HTC_PLAIN;
+
+        // Latin-1 umlauts and accents
+        add('\304', "&Auml;"), add('\326', "&Ouml;"), add('\334', "&Uuml;");
+        add('\337', "&szlig;"), add('\344', "&auml;"), add('\350', "&egrave;");
+        add('\351', "&eacute;"), add('\366', "&ouml;"), add('\374', "&uuml;");
+        add('&', "&amp;");
+    }
+
+    void add(char c, const char* e)
+    {
+        set(c, HTC_ENTITY);
+        entity[(unsigned char)c] = e;
+    }
+
+    void set(char c, html_text_class k)
+    {
+        cls[(unsigned char)c] = k;
+    }
+};
+
+//! scanner of HtmlText (quoted = false) or HtmlQuotedText
+class html_text_scanner
+{
+public:
+    explicit html_text_scanner(bool quoted)
+        : table_(quoted ? quoted_table() : text_table()) { }
+
+    static const html_text_table& text_table()
+    {
+        static const html_text_table t = [] {
+            html_text_table t("~@$^.,:;_=+({}|?/-");
+            t.add('"', "&quot;"), t.add('\'', "&apos;"), t.add('>', "&gt;");
+            t.set(' ', HTC_BLANK), t.set('\t', HTC_BLANK);
+            t.set('\r', HTC_EOL), t.set('\n', HTC_EOL);
+            return t;
+        }();
+        return t;
+    }
+
+    static const html_text_table& quoted_table()
+    {
+        static const html_text_table t = [] {
+            html_text_table t("~!@#$%^.,:;_=+*()[]{}>'|?/ -");
+            t.set('<', HTC_LT), t.set('\\', HTC_BACKSLASH);
+            return t;
+        }();
+        return t;
+    }
+
+    //! scan the text at first and advance first past it. While the text is
+    //! the input with whitespace runs collapsed, verbatim stays true and
+    //! nothing is copied to out, collapse tells if any run was not a space.
+    template <typename Iterator>
+    bool scan(Iterator& first, const Iterator& last,
+              std::string& out, bool& verbatim, bool& collapse) const
+    {
+        Iterator it = first;
+        verbatim = true, collapse = false;
+
+        while (it != last)
+        {
+            Iterator run = it;
+            while (it != last && table_.cls[(unsigned char)*it] == HTC_PLAIN)
+                ++it;
+            if (it != run) {
+                if (!verbatim) out.append(run, it);
+                continue;
+            }
+
+            Iterator start = it;
+            html_text_class cls = table_.cls[(unsigned char)*it];
+            const char* text;
+            size_t size;
+            if (!step(it, last, text, size))
+                break;
+
+            if (verbatim && (size != size_t(it - start) ||
+                             !std::equal(text, text + size, start)))
+            {
+                if (cls == HTC_BLANK || cls == HTC_EOL) {
+                    collapse = true;
+                    continue;
+                }
+                verbatim = false;
+                ast_span(boost::string_view(&*first, start - first), collapse)
+                    .append_to(out);
+            }
+            if (!verbatim) out.append(text, size);
+        }
+
+        if (it == first)
+            return false;
+        first = it;
+        return true;
+    }
+
+private:
+    //! consume one special character at it and return its replacement text,
+    //! returns false if it ends the text.
+    template <typename Iterator>
+    bool step(Iterator& it, const Iterator& last,
+              const char*& text, size_t& size) const
+    {
+        unsigned char c = *it;
+        Iterator next = it;
+        ++next;
+        size = 1;
+
+        switch (table_.cls[c])
+        {
+        case HTC_ENTITY:
+            text = table_.entity[c];
+            size = std::strlen(text);
+            it = next;
+            return true;
+        case HTC_LT:
+            if (next != last && *next == '%') return false;
+            text = "<";
+            it = next;
+            return true;
+        case HTC_BACKSLASH:
+            if (next == last || *next != '"') return false;
+            text = "\"";
+            it = ++next;
+            return true;
+        case HTC_BLANK:
+            // +blank >> -(eol >> *blank >> !eol)
+            while (it != last && (*it == ' ' || *it == '\t')) ++it;
+            next = it;
+            if (line_break(next, last)) it = next;
+            text = " ";
+            return true;
+        case HTC_EOL:
+            // eol >> *blank >> !eol
+            if (!line_break(it, last)) return false;
+            text = " ";
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    //! match eol >> *blank >> !eol and advance it if successful
+    template <typename Iterator>
+    static bool line_break(Iterator& it, const Iterator& last)
+    {
+        Iterator i = it;
+        if (i != last && *i == '\r') {
+            if (++i != last && *i == '\n') ++i;
+        }
+        else if (i != last && *i == '\n')
+            ++i;
+        else
+            return false;
+
+        while (i != last && (*i == ' ' || *i == '\t')) ++i;
+        if (i != last && (*i == '\r' || *i == '\n'))
+            return false;
+        it = i;
+        return true;
+    }
+
+    const html_text_table& table_;
+};
+
+/******************************************************************************/
+// Packrat memoization for qi::rule: many ordered choices in the grammar, like
+// Block's "Paragraph | InlineList", re-invoke the same rule at the same input
+// position after an alternative failed. memoize(rule, registry) wraps the
+// rule's parse function just like qi::debug() does, and caches the result of
+// each (rule, position) pair: success, end position and synthesized attribute.
+//
+// Memoization is only valid if the rule's result depends solely on the input
+// position: the rules must not have inherited attributes or side-effects. The
+// tables refer to positions in one input, hence they must be cleared before
+// each parse. Exceptions are not cached.
+
+//! statistics of a memoized rule
+struct memo_stats
+{
+    std::string rule_name;
+    size_t calls = 0, hits = 0, stores = 0, flushes = 0;
+};
+
+//! type-erased memo table, holds the statistics and the clear() method
+struct memo_table_base
+{
+    memo_stats stats;
+
+    virtual void clear() = 0;
+    virtual ~memo_table_base() { }
+};
+
+//! collection of all memo tables of a grammar
+struct memo_registry
+{
+    std::vector<std::shared_ptr<memo_table_base> > tables;
+
+    //! clear all tables, required before parsing a new input
+    void clear()
+    {
+        for (auto& t : tables) t->clear();
+    }
+
+    //! add the statistics of the tables of an equal grammar
+    void merge_stats(const memo_registry& other)
+    {
+        assert(tables.size() == other.tables.size());
+        for (size_t i = 0; i < tables.size(); ++i)
+        {
+            memo_stats& s = tables[i]->stats;
+            const memo_stats& o = other.tables[i]->stats;
+            s.calls += o.calls, s.hits += o.hits;
+            s.stores += o.stores, s.flushes += o.flushes;
+        }
+    }
+
+    //! print a table of per-rule statistics
+    void print_stats(std::ostream& os) const
+    {
+        os << std::left << std::setw(20) << "rule"
+           << std::right << std::setw(10) << "calls"
+           << std::setw(10) << "hits"
+           << std::setw(10) << "stores"
+           << std::setw(10) << "flushes" << std::endl;
+        for (const auto& t : tables)
+        {
+            const memo_stats& s = t->stats;
+            os << std::left << std::setw(20) << s.rule_name
+               << std::right << std::setw(10) << s.calls
+               << std::setw(10) << s.hits
+               << std::setw(10) << s.stores
+               << std::setw(10) << s.flushes << std::endl;
+        }
+    }
+};
+
+//! check memoization of a rule whose container attribute is passed through
+//! by its caller, prints the result and returns false if it is wrong.
+bool memo_self_test(std::ostream& os);
+
+/******************************************************************************/
+// MyMarkup parser
+
+template <typename Iterator = std::string::const_iterator>
+struct MyMarkupParser : qi::grammar<Iterator, ast_node()>
+{
+    // *** General Base Character Parsers
+
+    qi::rule<Iterator, ast_node()> HtmlText;
+    qi::rule<Iterator, std::string()> SpecialChar, PlainText;
+
+    qi::rule<Iterator> BlankLine, Indent;
+
+    // *** Inline Blocks with Special Formatting
+
+    qi::rule<Iterator, ast_node()> Inline, InlinePlain;
+
+    qi::rule<Iterator, ast_comment()> Comment, CommentBlock;
+
+    qi::rule<Iterator, ast_tagged_node()> Code, Emph, Strong;
+    qi::rule<Iterator, ast_nodelist()> CodeBlock, EmphBlock, StrongBlock;
+
+    qi::rule<Iterator, ast_html_node()> MarkLink;
+    qi::rule<Iterator, ast_nodelist()> MarkLinkText, MarkLinkRefList;
+    qi::rule<Iterator, ast_html_attr()> MarkLinkRef;
+
+    qi::rule<Iterator, ast_html_selfnode()> MarkImage;
+    qi::rule<Iterator, ast_html_attr()> MarkImageAlt, MarkImageSrc;
+
+    qi::rule<Iterator, ast_html_selfnode()> MarkDownload;
+    qi::rule<Iterator, ast_html_attr()> MarkDownloadRef;
+
+    qi::rule<Iterator, std::string()> HttpLink, SelfLink;
+
+    qi::rule<Iterator, ast_node()> FuncBlock, FuncInline;
+    qi::rule<Iterator, ast_func_filter()> FilterBlock, FilterInline;
+    qi::rule<Iterator, std::string()> VerbatimBlock, VerbatimInline;
+
+    // *** Inline HTML blocks
+
+    qi::symbols<char, html_tag_id> HtmlTagNames;
+    qi::rule<Iterator, html_tag_id()> HtmlTagName;
+    qi::rule<Iterator, std::string()> HtmlComment;
+
+    qi::rule<Iterator, ast_node()> HtmlPhrase;
+    qi::rule<Iterator, ast_html_node(), qi::locals<html_tag_id> > HtmlTagBlock;
+    qi::rule<Iterator, ast_html_selfnode()> HtmlTagSelfClose;
+    qi::rule<Iterator, ast_nodelist()> HtmlInline;
+
+    qi::rule<Iterator, ast_html_attr()> HtmlAttribute;
+    qi::rule<Iterator, ast_nodelist()> HtmlQuoted;
+    qi::rule<Iterator, ast_node()> HtmlQuotedText;
+
+    // *** Paragraph Blocks: Enumerations
+
+    qi::rule<Iterator> Bullet, Enumet;
+
+    qi::rule<Iterator, ast_tagged_node()> BulletList0, BulletList1, BulletList2;
+    qi::rule<Iterator, ast_tagged_node()> OrderedList0, OrderedList1, OrderedList2;
+
+    qi::rule<Iterator, ast_nodelist()> List0, List1, List2;
+
+    qi::rule<Iterator, ast_tagged_node()> ListItem0, ListItem1, ListItem2;
+
+    qi::rule<Iterator, ast_nodelist()> ListBlock0, ListBlock1, ListBlock2;
+    qi::rule<Iterator, ast_nodelist()> ListBlockLine0, ListBlockLine1, ListBlockLine2;
+
+    qi::rule<Iterator, ast_nodelist()> Line;
+
+    // *** Paragraph Blocks: Headers
+
+    qi::rule<Iterator, ast_tagged_node()> Header, Header1, Header2, Header3, Header4, Header5, Header6;
+
+    qi::rule<Iterator, ast_nodelist()> HeaderA;
+    qi::rule<Iterator, std::string()> HeaderAnchor;
+
+    qi::rule<Iterator, ast_tagged_node()> Header1A, Header2A, Header3A, Header4A, Header5A, Header6A;
+
+    // *** Source Highlighting Code Blocks
+
+    qi::rule<Iterator, ast_highlight()> HighlightBlock;
+
+    // *** Paragraph Blocks: Paragraphs and Plain
+
+    qi::rule<Iterator, ast_tagged_node()> Paragraph;
+    qi::rule<Iterator, ast_nodelist()> ParagraphBlock;
+
+    qi::rule<Iterator, ast_nodelist()> InlineList;
+
+    qi::rule<Iterator, ast_node()> Block;
+
+    qi::rule<Iterator, ast_nodelist()> BlockList;
+
+    qi::rule<Iterator, ast_node()> Start;
+
+    // *** Inline Procedural Language
+
+    typedef qi::space_type Skip;
+
+    qi::rule<Iterator, std::string()> FIdentifier;
+    qi::rule<Iterator, ast_func_variable(), Skip> FVariable;
+    qi::rule<Iterator, ast_func_string()> FString;
+    qi::rule<Iterator, ast_func_double(), Skip> FDouble;
+    qi::rule<Iterator, ast_func_integer(), Skip> FInteger;
+    qi::rule<Iterator, ast_func_call(), Skip> FCall;
+    qi::rule<Iterator, ast_node(), Skip> FBracket;
+
+    qi::rule<Iterator, ast_node(), Skip> FAtomic;
+    qi::rule<Iterator, ast_func_expr(), Skip> FExpr;
+
+    qi::rule<Iterator, ast_func_set(), Skip> FSetClause;
+    qi::rule<Iterator, ast_func_if(), Skip> FIfClause, FEvalIfClause;
+    qi::rule<Iterator, ast_func_for(), Skip> FForClause;
+    qi::rule<Iterator, ast_func_call(), Skip> FInclude;
+
+    qi::rule<Iterator, ast_node(), Skip> FClause;
+
+    qi::rule<Iterator, ast_func_variable(), Skip> FFilterSetClause;
+    qi::rule<Iterator, ast_func_template(), Skip> FFilterTemplateClause;
+    qi::rule<Iterator, ast_node(), Skip> FFilterClause;
+
+    // *** Packrat Memoization
+
+    //! memo tables of the memoized rules, cleared by parse_markup().
+    mutable memo_registry Memo;
+
+    // *** Configuration
+
+    //! the constructor's arguments, to construct equal parsers for threads
+    const bool UseMemo, UseSpans;
+    RuleProfiler* const Profiler;
+
+    // *** Construction
+
+    //! construct the grammar, optionally with memoization of selected rules
+    //! and with profiling of all rules. With spans, text nodes which need no
+    //! escaping refer to the input as ast_span instead of copying it, as do
+    //! the ast_source_text of comments, literals, highlights and filters.
+    explicit MyMarkupParser(bool memo = false, RuleProfiler* profiler = nullptr,
+                            bool spans = false);
+
+    //! parse one top-level Block at first and advance first past it. Start is
+    //! a sequence of these, this allows re-parsing a document block-wise.
+    bool parse_block(Iterator& first, const Iterator& last,
+                     ast_node& block) const;
+
+    static const MyMarkupParser& get(); // get singleton
+};
+
+extern template struct MyMarkupParser<std::string::const_iterator>;
+
+/******************************************************************************/
+
+#endif // !SPIRIT7_HTML_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,679 @@
+// Definition of the rules of the markup grammar declared in spirit7_html.hpp,
+// explicitly instantiated for std::string::const_iterator. This is the
+// expensive translation unit of spirit7_html, it only needs recompiling when
+// the grammar changes.
+
+#include <unordered_map>
+
+#include <boost/spirit/include/qi.hpp>
+#include <boost/spirit/include/phoenix.hpp>
+
+#include "spirit7_html.hpp"
+#include "rule_profiler.hpp"
+
+namespace phx = boost::phoenix;
+namespace ascii = boost::spirit::ascii;
+
+/******************************************************************************/
+// Packrat memoization of rules, see memo_registry in spirit7_html.hpp.
+
+//! memo table of a rule with attribute type Attr
+template <typename Iterator, typename Attr>
+struct memo_table : public memo_table_base
+{
+    struct entry
+    {
+        bool success;
+        Iterator end;
+        Attr attr;
+    };
+
+    //! positions are identified by the address of the character
+    typedef typename std::iterator_traits<Iterator>::value_type value_type;
+    std::unordered_map<const value_type*, entry> map;
+
+    //! bound on the number of entries, the table is flushed when it is full
+    size_t capacity;
+
+    explicit memo_table(size_t _capacity) : capacity(_capacity) {}
+
+    void clear() { map.clear(); }
+};
+
+//! replacement parse function of a memoized rule, modeled after qi::debug_handler
+template <typename Iterator, typename Context, typename Skipper, typename Attr>
+struct memo_handler
+{
+    typedef boost::function<
+        bool(Iterator& first, Iterator const& last,
+             Context& context, Skipper const& skipper)>
+    function_type;
+
+    function_type subject;
+    std::shared_ptr<memo_table<Iterator, Attr> > table;
+
+    typedef typename boost::spirit::traits::is_container<Attr>::type is_container;
+    typedef typename memo_table<Iterator, Attr>::entry entry;
+
+    // Qi passes a caller's container of the same type through to the rule,
+    // e.g. the member of a sequence's attribute, which may already hold the
+    // caller's elements. Hence only the elements which the rule appended are
+    // cached, and a hit appends them instead of assigning the container.
+
+    static size_t mark(const Attr& a, boost::mpl::true_) { return a.size(); }
+    static size_t mark(const Attr&, boost::mpl::false_) { return 0; }
+
+    static Attr appended(const Attr& a, size_t mark, boost::mpl::true_)
+    {
+        Attr r;
+        r.insert(r.end(), a.begin() + mark, a.end());
+        return r;
+    }
+    static Attr appended(const Attr& a, size_t, boost::mpl::false_)
+    {
+        return a;
+    }
+
+    static void restore(Attr& a, const Attr& cached, boost::mpl::true_)
+    {
+        a.insert(a.end(), cached.begin(), cached.end());
+    }
+    static void restore(Attr& a, const Attr& cached, boost::mpl::false_)
+    {
+        a = cached;
+    }
+
+    bool operator()(Iterator& first, Iterator const& last,
+                    Context& context, Skipper const& skipper) const
+    {
+        // the end position has no character address to use as key
+        if (first == last)
+            return subject(first, last, context, skipper);
+
+        ++table->stats.calls;
+        const auto* key = &*first;
+        // the rule's synthesized attribute _val
+        Attr& attr = context.attributes.car;
+
+        auto it = table->map.find(key);
+        if (it != table->map.end())
+        {
+            ++table->stats.hits;
+            // a failed rule leaves the elements it appended in a container,
+            // these are replayed too
+            if (!it->second.success) {
+                if (is_container::value)
+                    restore(attr, it->second.attr, is_container());
+                return false;
+            }
+            restore(attr, it->second.attr, is_container());
+            first = it->second.end;
+            return true;
+        }
+
+        size_t size = mark(attr, is_container());
+        bool success = subject(first, last, context, skipper);
+
+        if (table->map.size() >= table->capacity)
+        {
+            table->map.clear();
+            ++table->stats.flushes;
+        }
+        ++table->stats.stores;
+        if (success || is_container::value)
+            table->map.emplace(key, entry {
+                                   success, first,
+                                   appended(attr, size, is_container()) });
+        else
+            table->map.emplace(key, entry { false, first, Attr() });
+        return success;
+    }
+};
+
+//! enable memoization of a rule, its table is added to the registry.
+template <typename Iterator, typename T1, typename T2, typename T3, typename T4>
+void memoize(qi::rule<Iterator, T1, T2, T3, T4>& r, memo_registry& registry,
+             size_t capacity = 65536)
+{
+    typedef qi::rule<Iterator, T1, T2, T3, T4> rule_type;
+    typedef typename rule_type::attr_type attr_type;
+
+    auto table = std::make_shared<memo_table<Iterator, attr_type> >(capacity);
+    table->stats.rule_name = r.name();
+    registry.tables.push_back(table);
+
+    r.f = memo_handler<Iterator, typename rule_type::context_type,
+                       typename rule_type::skipper_type, attr_type> {
+        r.f, table };
+}
+
+/******************************************************************************/
+// HtmlText and HtmlQuotedText as a Qi primitive, see html_text_scanner.
+
+//! Qi primitive scanning HtmlText (quoted = false) or HtmlQuotedText. With
+//! spans, text which needs no escaping is returned as an ast_span of the input.
+struct html_text_parser : qi::primitive_parser<html_text_parser>
+{
+    template <typename Context, typename Iterator>
+    struct attribute { typedef std::string type; };
+
+    html_text_parser(bool quoted, bool spans)
+        : quoted_(quoted), spans_(spans), scanner_(quoted) { }
+
+    template <typename Iterator, typename Context, typename Skipper>
+    bool parse(Iterator& first, const Iterator& last, Context&,
+               const Skipper& skipper, ast_node& attr) const
+    {
+        qi::skip_over(first, last, skipper);
+
+        Iterator begin = first;
+        std::string text;
+        bool verbatim, collapse;
+        if (!scanner_.scan(first, last, text, verbatim, collapse))
+            return false;
+
+        ast_span span(boost::string_view(&*begin, first - begin), collapse);
+        if (verbatim && spans_)
+            attr = span;
+        else if (verbatim)
+            attr = span.str();
+        else
+            attr = std::move(text);
+        return true;
+    }
+
+    template <typename Iterator, typename Context, typename Skipper,
+              typename Attribute>
+    bool parse(Iterator& first, const Iterator& last, Context&,
+               const Skipper& skipper, Attribute& attr) const
+    {
+        qi::skip_over(first, last, skipper);
+
+        Iterator begin = first;
+        std::string text;
+        bool verbatim, collapse;
+        if (!scanner_.scan(first, last, text, verbatim, collapse))
+            return false;
+
+        if (verbatim)
+            text = ast_span(
+                boost::string_view(&*begin, first - begin), collapse).str();
+        boost::spirit::traits::assign_to(text, attr);
+        return true;
+    }
+
+    template <typename Context>
+    boost::spirit::info what(Context&) const
+    {
+        return boost::spirit::info(quoted_ ? "html_quoted_text" : "html_text");
+    }
+
+private:
+    bool quoted_, spans_;
+    html_text_scanner scanner_;
+};
+
+//! Qi parser matching its subject without collecting an attribute and
+//! yielding the matched input as Text, an ast_source_text: with spans as a
+//! span of the input, otherwise as one copy instead of appending character by
+//! character. Text is the exact type of the rule's attribute, such that Qi
+//! passes it through instead of converting a temporary, which loses the span.
+template <typename Text, typename Subject>
+struct source_text_parser
+    : qi::primitive_parser<source_text_parser<Text, Subject> >
+{
+    template <typename Context, typename Iterator>
+    struct attribute { typedef Text type; };
+
+    source_text_parser(const Subject& subject, bool spans)
+        : subject_(subject), spans_(spans) { }
+
+    template <typename Iterator, typename Context, typename Skipper,
+              typename Attribute>
+    bool parse(Iterator& first, const Iterator& last, Context& context,
+               const Skipper& skipper, Attribute& attr) const
+    {
+        qi::skip_over(first, last, skipper);
+
+        Iterator begin = first;
+        if (!subject_.parse(first, last, context, skipper,
+                            boost::spirit::unused))
+            return false;
+
+        store(attr, begin, first);
+        return true;
+    }
+
+    template <typename Context>
+    boost::spirit::info what(Context& context) const
+    {
+        return boost::spirit::info("source_text", subject_.what(context));
+    }
+
+private:
+    Subject subject_;
+    bool spans_;
+
+    template <typename Iterator>
+    void store(ast_source_text& text, Iterator begin, Iterator end) const
+    {
+        if (spans_)
+            text.span = boost::string_view(
+                begin != end ? &*begin : "", end - begin);
+        else
+            text.assign(begin, end);
+    }
+};
+
+namespace boost { namespace spirit { namespace traits {
+
+//! sequences pass their container attribute to a source_text_parser as a
+//! whole instead of collecting it element by element
+template <typename Text, typename Subject, typename Attribute,
+          typename Context, typename Iterator>
+struct handles_container<source_text_parser<Text, Subject>, Attribute,
+                         Context, Iterator>
+    : mpl::true_ { };
+
+}}} // namespace boost::spirit::traits
+
+//! wrap a parser expression in a source_text_parser yielding Text
+template <typename Text, typename Expr>
+source_text_parser<
+    Text, typename boost::spirit::result_of::compile<qi::domain, Expr>::type>
+source_text(const Expr& expr, bool spans)
+{
+    return { boost::spirit::compile<qi::domain>(expr), spans };
+}
+
+/******************************************************************************/
+// MyMarkup parser rules
+
+template <typename Iterator>
+MyMarkupParser<Iterator>::MyMarkupParser(
+    bool memo, RuleProfiler* profiler, bool spans)
+    : MyMarkupParser::base_type(Start, "MyMarkupParser"),
+      UseMemo(memo), UseSpans(spans), Profiler(profiler)
+{
+    using namespace boost::spirit::ascii;
+    using namespace qi::labels;
+
+    using qi::lit;
+    using qi::eoi;
+    using qi::eol;
+    using qi::attr;
+    using qi::omit;
+    using qi::as_string;
+
+    // ********************************************************************
+    // *** General Base Character Parsers
+
+    // text is composed of non-special characters, see html_text_parser
+    HtmlText %=     html_text_parser(false, spans);
+
+    // special characters, accepted if no special meaning
+    SpecialChar =   ( char_("*`#[])!") [ _val += _1 ]
+                      //| (lit('<') >> !lit("%")) [ _val += "&lt;" ]
+                      | lit("\\\\")   [ _val += '\\' ]
+                      | lit("\\\"")   [ _val += '"' ]
+                      | lit("\\&")    [ _val += '&' ]
+                      | lit("\\*")    [ _val += '*' ]
+                      | lit("\\#")    [ _val += '#' ]
+                      | lit("\\`")    [ _val += '`' ]
+                      | lit("\\[")    [ _val += '[' ]
+                      | lit("\\<")    [ _val += "&lt;" ]
+                      | (lit('%') >> !lit('%')) [ _val += '%' ]
+        );
+
+    // a blank file
+    BlankLine =     *blank >> eol;
+
+    // identation for lists
+    Indent =        lit('\t') | lit("  ");
+
+    // ********************************************************************
+    // *** Inline Blocks with Special Formatting
+
+    Inline %=       Comment | VerbatimInline | FilterInline | FuncInline | Code | Strong | Emph | SelfLink | MarkDownload | MarkLink | MarkImage | HtmlPhrase | HtmlText | SpecialChar;
+
+    InlinePlain %=  Comment | VerbatimInline | FilterInline | FuncInline | PlainText;
+
+    // inline comments
+
+    Comment %=      lit("<%#") >> source_text<ast_comment>(*(!lit("%>") >> char_), spans) >> "%>";
+
+    CommentBlock %= lit("<%#") >> source_text<ast_comment>(*(!lit("%>") >> char_), spans) >> "%>" >> omit[*eol];
+
+    // inline styling blocks
+
+    Code %=         '`' >> attr(html_tag_id::code) >> CodeBlock >> '`';
+    CodeBlock %=    +(!lit('`') >> Inline);
+
+    Emph %=         '*' >> attr(html_tag_id::i) >> EmphBlock >> '*';
+    EmphBlock %=    +(!lit('*') >> Inline);
+
+    Strong %=       "**" >> attr(html_tag_id::b) >> StrongBlock >> "**";
+    StrongBlock %=  +(!lit("**") >> Inline);
+
+    // markdown inline links
+
+    MarkLink =      ('[' >> MarkLinkText >> "](" >> MarkLinkRef >> ')')
+        [ _val = phx::construct<ast_html_node>(html_tag_id::markdown_a, _2, _1) ];
+
+    MarkLinkText %= +(!lit(']') >> Inline);
+    MarkLinkRef %=  attr("href") >> MarkLinkRefList;
+    MarkLinkRefList %= +(!lit(')') >> Inline);
+
+    // markdown inline images
+
+    MarkImage =     ("![" >> MarkImageAlt >> "](" >> MarkImageSrc >> ')')
+        [ _val = phx::construct<ast_html_selfnode>(html_tag_id::markdown_img, _1, _2) ];
+
+    MarkImageAlt %= attr("alt") >> MarkLinkText;
+    MarkImageSrc %= attr("src") >> MarkLinkRefList;
+
+    // markdown download/view links
+
+    MarkDownload =  "[[" >>
+        MarkDownloadRef [ _val = phx::construct<ast_html_selfnode>(html_tag_id::markdown_download, _1) ] >>
+        "]]";
+
+    MarkDownloadRef %= attr("href") >> as_string[ +~char_(']') ];
+
+    // self-link inline
+
+    HttpLink %=     string("http") >> +~char_('>');
+
+    SelfLink =      &lit("<http") >> '<' >> HttpLink
+        [ _val = "<a href=\"" + _1 + "\">" + _1 + "</a>" ]  >> '>';
+
+    // inline functional language
+
+    FuncBlock %=    "<%" >> qi::skip(qi::space)[FClause] >> omit[*space] >> "%>" >> omit[eol];
+
+    FuncInline %=   "<%" >> qi::skip(qi::space)[FClause] >> omit[*space] >> "%>";
+
+    FilterBlock %=  "<%|" >> qi::skip(qi::space)[FFilterClause] >> omit[*space] >> "%>" >> omit[eol]
+                          >> source_text<ast_source_text>(*(!(eol >> "<%|%>") >> char_), spans)
+                          >> omit[eol] >> "<%|%>";
+
+    FilterInline %= "<%|" >> qi::skip(qi::space)[FFilterClause] >> omit[*space] >> "%>" >> omit[-eol]
+                          >> source_text<ast_source_text>(*(!(-eol >> "<%|%>") >> char_), spans)
+                          >> omit[-eol] >> "<%|%>";
+
+    VerbatimBlock %= "<%$" >> omit[eol] >> *(!lit("%>") >> char_) >> "%>" >> omit[eol];
+
+    VerbatimInline %= "<%$" >> *(!lit("%>") >> char_) >> "%>";
+
+    // ********************************************************************
+    // *** Inline HTML blocks
+
+#define MYMARKUP_HTML_TAG_ADD(r, data, tag) \
+    (BOOST_PP_STRINGIZE(tag), html_tag_id::tag)
+
+    // symbols match the longest tag name, e.g. "thead" before "th"
+    HtmlTagNames.add
+        BOOST_PP_SEQ_FOR_EACH(MYMARKUP_HTML_TAG_ADD, _, MYMARKUP_HTML_TAGS);
+
+#undef MYMARKUP_HTML_TAG_ADD
+
+    HtmlTagName =   HtmlTagNames;
+    HtmlTagName.name("HtmlTagName");
+
+    HtmlPhrase %=   &lit('<') >> ( HtmlTagBlock | HtmlComment | HtmlTagSelfClose );
+
+    HtmlTagBlock %= '<' >> HtmlTagName [_a = qi::_1]
+                        >> *HtmlAttribute >> omit[*space] >> '>' >> omit[*eol]
+                        >> HtmlInline
+                        >> omit["</" > HtmlTagName [_pass = (qi::_1 == _a)] >> '>']
+                        >> omit[*eol];
+
+    HtmlInline %=   *( Inline >> omit[*eol] );
+
+    HtmlTagSelfClose %= '<' >> HtmlTagName
+                            >> *HtmlAttribute >> omit[*space] >> "/>"
+                            >> omit[*eol];
+
+    HtmlComment %=  string("<!--") >> *(!lit("-->") >> char_) >> string("-->") >> omit[*eol];
+
+    HtmlAttribute %= omit[+space] >> +(alnum | char_('-')) >> omit[*space >> '=' >> *space] >> HtmlQuoted;
+
+    HtmlQuotedText %= html_text_parser(true, spans);
+
+    HtmlQuoted %=   '"' >> *(!lit('"') >> (Comment | FuncInline | HtmlQuotedText)) >> '"';
+
+    qi::on_error<qi::fail>(
+        HtmlTagBlock,
+        std::cout << phx::val("{debug error expecting ") << _4 << phx::val(" here: \"")
+        << phx::construct<std::string>(_3, _2)   // iterators to error-pos, end
+        << phx::val("\"}") << std::endl
+        );
+
+    // ********************************************************************
+    // *** Paragraph Blocks: Enumerations
+
+    Bullet =          char_("+*-") >> +blank;
+    Enumet =          +digit >> '.' >> +blank;
+
+    BulletList0 %=    &Bullet >> attr(html_tag_id::ul) >> List0;
+    OrderedList0 %=   &Enumet >> attr(html_tag_id::ol) >> List0;
+
+    BulletList1 %=    &(Indent >> Bullet) >> attr(html_tag_id::ul) >> List1;
+    OrderedList1 %=   &(Indent >> Enumet) >> attr(html_tag_id::ol) >> List1;
+
+    BulletList2 %=    &(Indent >> Indent >> Bullet) >> attr(html_tag_id::ul) >> List2;
+    OrderedList2 %=   &(Indent >> Indent >> Enumet) >> attr(html_tag_id::ol) >> List2;
+
+    List0 %=          +ListItem0;
+    List1 %=          +ListItem1;
+    List2 %=          +ListItem2;
+
+    ListItem0 %=      omit[(Bullet | Enumet)] >> attr(html_tag_id::li) >> ListBlock0;
+    ListItem1 %=      omit[Indent >> (Bullet | Enumet)] >> attr(html_tag_id::li) >> ListBlock1;
+    ListItem2 %=      omit[Indent >> Indent >> (Bullet | Enumet)] >> attr(html_tag_id::li) >> ListBlock2;
+
+    ListBlock0 %=     !BlankLine >> Line >> *( BulletList1 | OrderedList1 | ListBlockLine0 );
+    ListBlock1 %=     !BlankLine >> Line >> *( BulletList2 | OrderedList2 | ListBlockLine1 );
+    ListBlock2 %=     !BlankLine >> Line >> *( ListBlockLine2 );
+
+    ListBlockLine0 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
+                                 >> Indent >> attr(" ") >> Line;
+
+    ListBlockLine1 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
+                                 >> Indent >> Indent >> attr(" ") >> Line;
+
+    ListBlockLine2 %= !BlankLine >> !( *Indent >> (Bullet | Enumet) )
+                                 >> Indent >> Indent >> Indent >> attr(" ") >> Line;
+
+    // inline will gobble single eols, but stop at double eols.
+    Line %=           +Inline >> omit[(eol >> BlankLine) | (*eol >> eoi)];
+
+    // ********************************************************************
+    // *** Paragraph Blocks: Headers
+
+    Header6 %=        "###### " >> attr(html_tag_id::h6) >> InlineList;
+    Header5 %=        "##### "  >> attr(html_tag_id::h5) >> InlineList;
+    Header4 %=        "#### "   >> attr(html_tag_id::h4) >> InlineList;
+    Header3 %=        "### "    >> attr(html_tag_id::h3) >> InlineList;
+    Header2 %=        "## "     >> attr(html_tag_id::h2) >> InlineList;
+    Header1 %=        "# "      >> attr(html_tag_id::h1) >> InlineList;
+
+    HeaderAnchor =    as_string[ +~char_(')') ]
+        [ _val = "<a id=\"" + _1 + "\"></a>" ];
+
+    HeaderA %=        HeaderAnchor >> lit(") ") >> InlineList;
+
+    Header6A %=       "######(" >> attr(html_tag_id::h6) >> HeaderA;
+    Header5A %=       "#####("  >> attr(html_tag_id::h5) >> HeaderA;
+    Header4A %=       "####("   >> attr(html_tag_id::h4) >> HeaderA;
+    Header3A %=       "###("    >> attr(html_tag_id::h3) >> HeaderA;
+    Header2A %=       "##("     >> attr(html_tag_id::h2) >> HeaderA;
+    Header1A %=       "#("      >> attr(html_tag_id::h1) >> HeaderA;
+
+    Header %=         &lit('#') >> ( Header6A | Header5A | Header4A | Header3A | Header2A | Header1A |
+                                     Header6 | Header5 | Header4 | Header3 | Header2 | Header1 );
+
+    // ********************************************************************
+    // *** Source Highlighting Code Blocks
+
+    HighlightBlock %= "```" >> omit[*blank] >> *print >> omit[eol]
+                            >> source_text<ast_source_text>(*(!(eol >> "```") >> char_), spans)
+                            >> omit[eol] >> "```" >> omit[*blank >> eol];
+
+    // ********************************************************************
+    // *** Paragraph Blocks: Paragraphs and Plain
+
+    Paragraph %=    attr(html_tag_id::p) >> ParagraphBlock >> omit[+(eol | blank >> eoi)];
+    ParagraphBlock %= InlineList;
+
+    InlineList %=   +Inline;
+
+    Block %=        omit[*BlankLine] >> (
+        CommentBlock |
+        VerbatimBlock | FilterBlock | FuncBlock |
+        HighlightBlock |
+        Header |
+        BulletList0 | OrderedList0 |
+        HtmlPhrase |
+        Paragraph | InlineList );
+
+    BlockList %=    *Block;
+
+    Start %=        BlockList;
+
+    // ********************************************************************
+    // *** Inline Procedural Language
+
+    FIdentifier %=  char_("A-Za-z_") >> *char_("A-Za-z0-9_");
+
+    FVariable %=    FIdentifier;
+
+    // literals without escaped quotes are taken as they are
+    FString %=      (lit('"') >> source_text<ast_func_string>(*(!lit('"') >> !lit("\\\"") >> char_) >> &lit('"'), spans) >> '"')
+                  | ('"' >> *(!lit('"') >> ((lit("\\\"") >> attr('"')) | char_)) >> '"');
+
+    FDouble %=      qi::real_parser< double, qi::strict_real_policies<double> >();
+
+    FInteger %=     qi::long_long;
+
+    FCall %=        FIdentifier >> '(' >> -(FExpr % ',') >> ')';
+
+    FBracket %=     '(' >> FExpr >> ')';
+
+    FAtomic %=      FBracket | FCall | FString | FDouble | FInteger | FVariable;
+
+    FExpr %=        FAtomic % as_string[char_("+")] [ phx::push_back(_val,_1) ];
+
+    FSetClause %=   -lit("SET") >> FIdentifier >> '=' >> FExpr;
+
+    FIfClause %=    "IF" >> FExpr >> "%%" >> Start >> "%%"
+                         >> -(lit("ELSE") >> "%%" >> Start >> "%%")
+                         >> "ENDIF";
+
+    FEvalIfClause %= "EVALIF" >> FExpr >> "%%" >> FClause >> "%%"
+                              >> -(lit("ELSE") >> "%%" >> FClause >> "%%")
+                              >> "ENDIF";
+
+    FForClause %=   "FOR" >> FIdentifier >> '=' >> FExpr >> "%%" >> Start >> "%%"
+                          >> "ENDFOR";
+
+    FInclude %=     "INCLUDE" >> attr("include") >> FIdentifier;
+
+    FClause %=      FSetClause | FEvalIfClause | FIfClause | FForClause | FInclude | FExpr;
+
+    FFilterSetClause %= "SET" >> FIdentifier;
+
+    FFilterTemplateClause %= "TEMPLATE" >> FIdentifier;
+
+    FFilterClause %= FFilterSetClause | FFilterTemplateClause | FCall;
+
+    // ********************************************************************
+    // *** Packrat Memoization
+
+    if (memo)
+    {
+        // InlineList is re-parsed by Block if Paragraph fails at its end.
+        // HtmlTagName is re-parsed by each alternative of HtmlPhrase, but a
+        // lookup in its trie is cheaper than in a memo table.
+        InlineList.name("InlineList");
+
+        memoize(InlineList, Memo);
+    }
+
+    // ********************************************************************
+    // *** Profiling
+
+    if (profiler)
+    {
+#define MYMARKUP_PROFILE_RULE(r, profiler, rule) \
+        rule.name(BOOST_PP_STRINGIZE(rule)); profiler->profile(rule);
+
+        BOOST_PP_SEQ_FOR_EACH(MYMARKUP_PROFILE_RULE, profiler,
+        (HtmlText)(SpecialChar)(PlainText)(BlankLine)(Indent)(Inline)
+        (InlinePlain)(Comment)(CommentBlock)(Code)(Emph)(Strong)(CodeBlock)
+        (EmphBlock)(StrongBlock)(MarkLink)(MarkLinkText)(MarkLinkRefList)
+        (MarkLinkRef)(MarkImage)(MarkImageAlt)(MarkImageSrc)(MarkDownload)
+        (MarkDownloadRef)(HttpLink)(SelfLink)(FuncBlock)(FuncInline)
+        (FilterBlock)(FilterInline)(VerbatimBlock)(VerbatimInline)(HtmlTagName)
+        (HtmlComment)(HtmlPhrase)(HtmlTagBlock)(HtmlTagSelfClose)(HtmlInline)
+        (HtmlAttribute)(HtmlQuoted)(HtmlQuotedText)(Bullet)(Enumet)(BulletList0)
+        (BulletList1)(BulletList2)(OrderedList0)(OrderedList1)(OrderedList2)
+        (List0)(List1)(List2)(ListItem0)(ListItem1)(ListItem2)(ListBlock0)
+        (ListBlock1)(ListBlock2)(ListBlockLine0)(ListBlockLine1)(ListBlockLine2)
+        (Line)(Header)(Header1)(Header2)(Header3)(Header4)(Header5)(Header6)
+        (HeaderA)(HeaderAnchor)(Header1A)(Header2A)(Header3A)(Header4A)
+        (Header5A)(Header6A)(HighlightBlock)(Paragraph)(ParagraphBlock)
+        (InlineList)(Block)(BlockList)(Start)(FIdentifier)(FVariable)(FString)
+        (FDouble)(FInteger)(FCall)(FBracket)(FAtomic)(FExpr)(FSetClause)
+        (FIfClause)(FEvalIfClause)(FForClause)(FInclude)(FClause)
+        (FFilterSetClause)(FFilterTemplateClause)(FFilterClause)
+            );
+
+#undef MYMARKUP_PROFILE_RULE
+    }
+
+    // ********************************************************************
+}
+
+template <typename Iterator>
+bool MyMarkupParser<Iterator>::parse_block(
+    Iterator& first, const Iterator& last, ast_node& block) const
+{
+    return qi::parse(first, last, Block, block);
+}
+
+template struct MyMarkupParser<std::string::const_iterator>;
+
+/******************************************************************************/
+// Regression test of memoization with a pass-through container: hold[] makes
+// the first alternative parse into a copy of the string, '#' is appended to
+// it before the memoized Word is called, and then the alternative fails. The
+// second alternative hits Word's cached result, which must append "abc" and
+// not restore "#abc", the string which Word saw on the first call.
+
+bool memo_self_test(std::ostream& os)
+{
+    typedef std::string::const_iterator Iterator;
+
+    memo_registry registry;
+    qi::rule<Iterator, std::string()> Word = +ascii::alpha;
+    Word.name("Word");
+    memoize(Word, registry);
+
+    qi::rule<Iterator, std::string()> Start =
+        qi::hold[qi::char_('#') >> Word >> '!'] | (qi::omit['#'] >> Word);
+
+    const std::string input = "#abc";
+    Iterator first = input.begin();
+    std::string attr;
+    bool r = qi::parse(first, input.end(), Start, attr);
+
+    bool ok = r && first == input.end() && attr == "abc" &&
+              registry.tables[0]->stats.hits == 1;
+    os << "memo_self_test: parsed \"" << attr << "\", "
+       << registry.tables[0]->stats.hits << " hits: "
+       << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+/******************************************************************************/
@@ -0,0 +1,391 @@
+// Example how to port Qi grammars to Boost Spirit X3. X3 parsers are objects
+// built at compile time: there is no runtime grammar construction and rules
+// are not type-erased, so the whole parser can be inlined.
+//
+// This ports the Stock grammar of spirit4_struct.cpp, the evaluating arithmetic
+// grammar of spirit3_arithmetic.cpp and the AST grammar of spirit5_ast.cpp,
+// with the same Stock struct, value types and AST nodes. "spirit8_x3 --stock
+// stock_list.txt" parses the stock list, "spirit8_x3 --bench" prints RESULT
+// lines which compare directly with those of "spirit3_arithmetic --bench" and
+// "spirit5_ast --bench". The markup grammar of spirit7_html is ported in
+// spirit9_x3_markup.cpp.
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/spirit/home/x3.hpp>
+#include <boost/fusion/include/adapt_struct.hpp>
+
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+
+namespace x3 = boost::spirit::x3;
+
+/******************************************************************************/
+
+// Helper to run a parser, check for errors, and capture the result.
+template <typename Parser, typename Attribute>
+void ParseOrDie(const std::string& input, const Parser& p, Attribute& attr)
+{
+    ParseStatsScope stats("ParseOrDie", input.size());
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    bool ok = x3::parse(begin, end, p, attr);
+    if (!ok || begin != end) {
+        std::cout << "Unparseable: "
+                  << std::quoted(std::string(begin, end)) << std::endl;
+        throw std::runtime_error("Parse error");
+    }
+}
+
+// Helper to run a parser with a skipper, check for errors, and capture the
+// result.
+template <typename Parser, typename Skipper, typename Attribute>
+void PhraseParseOrDie(
+    const std::string& input, const Parser& p, const Skipper& s,
+    Attribute& attr)
+{
+    ParseStatsScope stats("PhraseParseOrDie", input.size());
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    bool ok = x3::phrase_parse(begin, end, p, s, attr);
+    if (!ok || begin != end) {
+        std::cout << "Unparseable: "
+                  << std::quoted(std::string(begin, end)) << std::endl;
+        throw std::runtime_error("Parse error");
+    }
+}
+
+/******************************************************************************/
+// The Stock struct of spirit4_struct.cpp, adapted with Boost Fusion.
+
+struct Stock
+{
+    std::string symbol;
+    std::string name;
+    double price;
+
+    // and how to format it to cout
+    friend std::ostream& operator << (std::ostream& os, const Stock& s)
+    {
+        return os << "[Stock"
+                  << " symbol=" << std::quoted(s.symbol)
+                  << " name=" << std::quoted(s.name)
+                  << " price=" << s.price
+                  << "]";
+    }
+};
+
+BOOST_FUSION_ADAPT_STRUCT(
+    Stock,
+    (std::string, symbol)
+    (std::string, name)
+    (double, price)
+)
+
+// StockGrammar2 in X3: the rules are declared with an ID type and their
+// attribute, defined by a parser expression, and bound with
+// BOOST_SPIRIT_DEFINE. Nothing happens at runtime until the parser is called.
+namespace stock_grammar {
+
+x3::rule<class name_class, std::string> const name = "name";
+x3::rule<class stock_class, Stock> const stock = "stock";
+
+auto const name_def = *(~x3::char_(';'));
+auto const stock_def =
+    name >> ';' >> name >> ';' >> x3::double_ >> -(x3::lit(';'));
+
+BOOST_SPIRIT_DEFINE(name, stock);
+
+} // namespace stock_grammar
+
+void test1_stream(std::istream& input)
+{
+    std::string line;
+    while (std::getline(input, line)) {
+        Stock stock;
+        ParseOrDie(line, stock_grammar::stock, stock);
+        std::cout << stock << std::endl;
+    }
+}
+
+/******************************************************************************/
+// ArithmeticGrammar2 of spirit3_arithmetic.cpp in X3, templated on the value
+// type. Semantic actions are plain lambdas which access the rule's value with
+// _val() and the parsed attribute with _attr().
+
+namespace arithmetic_grammar {
+
+// the literal parser of each value type
+template <typename Value>
+struct ValueParser;
+
+template <>
+struct ValueParser<int64_t> {
+    static x3::int_parser<int64_t> parser() { return { }; }
+};
+
+template <>
+struct ValueParser<double> {
+    static x3::real_parser<double> parser() { return { }; }
+};
+
+auto const assign = [](auto& ctx) { x3::_val(ctx) = x3::_attr(ctx); };
+auto const add = [](auto& ctx) { x3::_val(ctx) += x3::_attr(ctx); };
+auto const multiply = [](auto& ctx) { x3::_val(ctx) *= x3::_attr(ctx); };
+
+// BOOST_SPIRIT_DEFINE only works for rules of fixed type, hence the rules are
+// variable templates and parse_rule() is written out for each of them.
+template <typename Value>
+struct start_class;
+template <typename Value>
+struct product_class;
+template <typename Value>
+struct factor_class;
+
+template <typename Value>
+using start_rule = x3::rule<start_class<Value>, Value>;
+template <typename Value>
+using product_rule = x3::rule<product_class<Value>, Value>;
+template <typename Value>
+using factor_rule = x3::rule<factor_class<Value>, Value>;
+
+template <typename Value>
+start_rule<Value> const start = "start";
+template <typename Value>
+product_rule<Value> const product = "product";
+template <typename Value>
+factor_rule<Value> const factor = "factor";
+
+template <typename Value, typename Iterator, typename Context>
+bool parse_rule(start_rule<Value>, Iterator& first, const Iterator& last,
+                const Context& context, Value& attr)
+{
+    static auto const def =
+        (start<Value> = product<Value>[assign]
+         >> *('+' >> product<Value>[add]));
+    return def.parse(first, last, context, x3::unused, attr);
+}
+
+template <typename Value, typename Iterator, typename Context>
+bool parse_rule(product_rule<Value>, Iterator& first, const Iterator& last,
+                const Context& context, Value& attr)
+{
+    static auto const def =
+        (product<Value> = factor<Value>[assign]
+         >> *('*' >> factor<Value>[multiply]));
+    return def.parse(first, last, context, x3::unused, attr);
+}
+
+template <typename Value, typename Iterator, typename Context>
+bool parse_rule(factor_rule<Value>, Iterator& first, const Iterator& last,
+                const Context& context, Value& attr)
+{
+    static auto const def =
+        (factor<Value> = ValueParser<Value>::parser()[assign] |
+         ('(' >> start<Value> >> ')')[assign]);
+    return def.parse(first, last, context, x3::unused, attr);
+}
+
+} // namespace arithmetic_grammar
+
+template <typename Value>
+void test2(std::string input, const char* name)
+{
+    try {
+        Value out_value;
+
+        PhraseParseOrDie(input, arithmetic_grammar::start<Value>, x3::space,
+                         out_value);
+
+        std::cout << "test2<" << name << ">() parse result: "
+                  << out_value << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cout << "test2<" << name << ">() EXCEPTION: " << e.what()
+                  << std::endl;
+    }
+}
+
+/******************************************************************************/
+// The AST nodes of spirit5_ast.cpp: n-ary operator nodes and constants.
+
+class ASTNode
+{
+public:
+    virtual double evaluate() = 0;
+    virtual ~ASTNode() { }
+};
+
+using ASTNodePtr = ASTNode*;
+
+template <char Operator>
+class OperatorNode : public ASTNode
+{
+public:
+    OperatorNode(const ASTNodePtr& left, const ASTNodePtr& right)
+        : operands({ left, right }) { }
+
+    double evaluate() {
+        double result = operands[0]->evaluate();
+        for (size_t i = 1; i < operands.size(); ++i) {
+            if (Operator == '+')
+                result += operands[i]->evaluate();
+            else if (Operator == '*')
+                result *= operands[i]->evaluate();
+        }
+        return result;
+    }
+
+    // semantic action helper: extend the operator node in left with another
+    // operand, or create a new one if left is a different node.
+    static ASTNodePtr append(const ASTNodePtr& left, const ASTNodePtr& right) {
+        if (OperatorNode* op = dynamic_cast<OperatorNode*>(left)) {
+            op->operands.push_back(right);
+            return op;
+        }
+        return new OperatorNode(left, right);
+    }
+
+    ~OperatorNode() {
+        for (ASTNodePtr& node : operands)
+            delete node;
+    }
+
+private:
+    std::vector<ASTNodePtr> operands;
+};
+
+class ConstantNode : public ASTNode
+{
+public:
+    ConstantNode(double value)
+        : value(value) { }
+
+    double evaluate() {
+        return value;
+    }
+
+private:
+    double value;
+};
+
+// ArithmeticGrammar1 of spirit5_ast.cpp in X3. The rules have fixed types,
+// hence they are bound with BOOST_SPIRIT_DEFINE like the Stock grammar.
+namespace ast_grammar {
+
+x3::rule<class start_class, ASTNodePtr> const start = "start";
+x3::rule<class group_class, ASTNodePtr> const group = "group";
+x3::rule<class product_class, ASTNodePtr> const product = "product";
+x3::rule<class factor_class, ASTNodePtr> const factor = "factor";
+
+auto const assign = [](auto& ctx) { x3::_val(ctx) = x3::_attr(ctx); };
+auto const add = [](auto& ctx) {
+    x3::_val(ctx) = OperatorNode<'+'>::append(x3::_val(ctx), x3::_attr(ctx));
+};
+auto const multiply = [](auto& ctx) {
+    x3::_val(ctx) = OperatorNode<'*'>::append(x3::_val(ctx), x3::_attr(ctx));
+};
+auto const constant = [](auto& ctx) {
+    x3::_val(ctx) = new ConstantNode(x3::_attr(ctx));
+};
+
+// the first product is the result, all following ones are appended to one
+// n-ary OperatorNode, without backtracking.
+auto const start_def = product[assign] >> *('+' >> product[add]);
+auto const product_def = factor[assign] >> *('*' >> factor[multiply]);
+auto const factor_def = group[assign] | x3::int_[constant];
+auto const group_def = '(' >> start >> ')';
+
+BOOST_SPIRIT_DEFINE(start, group, product, factor);
+
+} // namespace ast_grammar
+
+void test3_ast(std::string input)
+{
+    try {
+        ASTNode* out_node = nullptr;
+        PhraseParseOrDie(input, ast_grammar::start, x3::space, out_node);
+
+        std::cout << "test3_ast() evaluate() = " << out_node->evaluate()
+                  << std::endl;
+        delete out_node;
+    }
+    catch (std::exception& e) {
+        std::cout << "test3_ast() EXCEPTION: " << e.what() << std::endl;
+    }
+}
+
+/******************************************************************************/
+// Throughput benchmark of the X3 evaluation and AST, the RESULT lines use the
+// same benchmark name and inputs as "spirit3_arithmetic --bench" and
+// "spirit5_ast --bench".
+
+template <typename Value>
+void BenchmarkValue(const char* name, const std::string& input,
+                    size_t terms, size_t depth, size_t reps)
+{
+    RunBenchmark(
+        "arithmetic_eval", std::string("spirit8_x3_") + name,
+        input, terms, depth, reps,
+        [&](const std::string& input) {
+            Value out_value;
+            PhraseParseOrDie(input, arithmetic_grammar::start<Value>,
+                             x3::space, out_value);
+            return static_cast<double>(out_value);
+        });
+}
+
+void test4_benchmark()
+{
+    RunExpressionBenchmarks(
+        "spirit8_x3",
+        [](const std::string& input, size_t terms, size_t depth, size_t reps) {
+            BenchmarkValue<int64_t>("int64", input, terms, depth, reps);
+            BenchmarkValue<double>("double", input, terms, depth, reps);
+            // the same as "spirit5_ast --bench"
+            RunBenchmark(
+                "arithmetic_eval", "spirit8_x3_ast", input, terms, depth, reps,
+                [&](const std::string& input) {
+                    ASTNode* out_node = nullptr;
+                    PhraseParseOrDie(input, ast_grammar::start, x3::space,
+                                     out_node);
+                    double result = out_node->evaluate();
+                    delete out_node;
+                    return result;
+                });
+        });
+}
+
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        test4_benchmark();
+        return 0;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--stock") {
+        if (argc >= 3) {
+            std::ifstream in(argv[2]);
+            test1_stream(in);
+        }
+        else {
+            std::cout << "Reading stdin" << std::endl;
+            test1_stream(std::cin);
+        }
+        return 0;
+    }
+
+    std::string input = argc >= 2 ? argv[1] : "1 + 2 * 3";
+    test2<int64_t>(input, "int64");
+    test2<double>(input, "double");
+    test3_ast(input);
+
+    return 0;
+}
+
+/******************************************************************************/
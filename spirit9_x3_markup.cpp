@@ -0,0 +1,549 @@
+// Example how to port the hot rules of the markup grammar of spirit7_html.cpp
+// to Boost Spirit X3: the inline formatting and text rules, and the paragraph,
+// header, comment and code blocks around them. The X3 parser is a constant
+// object, it needs no construction at runtime, while MyMarkupParser builds
+// more than 100 qi::rules in its constructor.
+//
+// The X3 rules produce the same AST types of spirit7_html.hpp, and the
+// HtmlText scanner is shared with the Qi grammar. MyMarkupParser is linked
+// from spirit7_html_grammar.cpp, hence both parsers can be compared on the
+// same input. Not ported are the template directives "<% ... %>", HTML tags
+// and lists: on documents containing them the ASTs differ.
+//
+// "spirit9_x3_markup [FILE]" parses the file (or stdin) with both parsers and
+// compares the ASTs, "spirit9_x3_markup --bench" prints RESULT lines for
+// generated documents.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <boost/spirit/home/x3.hpp>
+#include <boost/fusion/include/at_c.hpp>
+
+#include "benchmark.hpp"
+#include "parse_stats.hpp"
+#include "spirit7_html.hpp"
+
+namespace x3 = boost::spirit::x3;
+
+/******************************************************************************/
+// HtmlText as an X3 parser, the same scanner as html_text_parser without
+// spans.
+
+struct html_text_x3 : x3::parser<html_text_x3>
+{
+    typedef std::string attribute_type;
+    static bool const has_attribute = true;
+
+    html_text_scanner scanner { false };
+
+    template <typename Iterator, typename Context, typename RContext,
+              typename Attribute>
+    bool parse(Iterator& first, const Iterator& last, const Context& context,
+               RContext&, Attribute& attr) const
+    {
+        x3::skip_over(first, last, context);
+
+        Iterator begin = first;
+        std::string text;
+        bool verbatim, collapse;
+        if (!scanner.scan(first, last, text, verbatim, collapse))
+            return false;
+
+        if (verbatim)
+            text = ast_span(
+                boost::string_view(&*begin, first - begin), collapse).str();
+        x3::traits::move_to(text, attr);
+        return true;
+    }
+};
+
+/******************************************************************************/
+// The markup rules in X3, named like their counterparts in MyMarkupParser.
+// Semantic actions are plain lambdas which construct the nodes where the Qi
+// rules use phoenix::construct.
+
+namespace markup_grammar {
+
+using x3::lit;
+using x3::char_;
+using x3::eol;
+using x3::eoi;
+using x3::omit;
+using x3::ascii::blank;
+using x3::ascii::print;
+
+x3::rule<class text_class, std::string> const HtmlText = "HtmlText";
+x3::rule<class special_char_class, std::string> const SpecialChar = "SpecialChar";
+x3::rule<class blank_line_class> const BlankLine = "BlankLine";
+
+x3::rule<class inline_class, ast_node> const Inline = "Inline";
+x3::rule<class comment_class, ast_comment> const Comment = "Comment";
+x3::rule<class comment_block_class, ast_comment> const CommentBlock = "CommentBlock";
+
+x3::rule<class code_class, ast_tagged_node> const Code = "Code";
+x3::rule<class emph_class, ast_tagged_node> const Emph = "Emph";
+x3::rule<class strong_class, ast_tagged_node> const Strong = "Strong";
+x3::rule<class code_block_class, ast_nodelist> const CodeBlock = "CodeBlock";
+x3::rule<class emph_block_class, ast_nodelist> const EmphBlock = "EmphBlock";
+x3::rule<class strong_block_class, ast_nodelist> const StrongBlock = "StrongBlock";
+
+x3::rule<class mark_link_class, ast_html_node> const MarkLink = "MarkLink";
+x3::rule<class mark_link_text_class, ast_nodelist> const MarkLinkText = "MarkLinkText";
+x3::rule<class mark_link_ref_class, ast_html_attr> const MarkLinkRef = "MarkLinkRef";
+x3::rule<class mark_link_ref_list_class, ast_nodelist> const MarkLinkRefList = "MarkLinkRefList";
+
+x3::rule<class mark_image_class, ast_html_selfnode> const MarkImage = "MarkImage";
+x3::rule<class mark_image_alt_class, ast_html_attr> const MarkImageAlt = "MarkImageAlt";
+x3::rule<class mark_image_src_class, ast_html_attr> const MarkImageSrc = "MarkImageSrc";
+
+x3::rule<class mark_download_class, ast_html_selfnode> const MarkDownload = "MarkDownload";
+x3::rule<class mark_download_ref_class, ast_html_attr> const MarkDownloadRef = "MarkDownloadRef";
+x3::rule<class mark_download_href_class, std::string> const MarkDownloadHref = "MarkDownloadHref";
+
+x3::rule<class http_link_class, std::string> const HttpLink = "HttpLink";
+x3::rule<class self_link_class, std::string> const SelfLink = "SelfLink";
+
+x3::rule<class verbatim_block_class, std::string> const VerbatimBlock = "VerbatimBlock";
+x3::rule<class verbatim_inline_class, std::string> const VerbatimInline = "VerbatimInline";
+
+x3::rule<class header_class, ast_tagged_node> const Header = "Header";
+x3::rule<class header1_class, ast_tagged_node> const Header1 = "Header1";
+x3::rule<class header2_class, ast_tagged_node> const Header2 = "Header2";
+x3::rule<class header3_class, ast_tagged_node> const Header3 = "Header3";
+x3::rule<class header4_class, ast_tagged_node> const Header4 = "Header4";
+x3::rule<class header5_class, ast_tagged_node> const Header5 = "Header5";
+x3::rule<class header6_class, ast_tagged_node> const Header6 = "Header6";
+x3::rule<class header_a_class, ast_nodelist> const HeaderA = "HeaderA";
+x3::rule<class header_anchor_class, std::string> const HeaderAnchor = "HeaderAnchor";
+x3::rule<class header1a_class, ast_tagged_node> const Header1A = "Header1A";
+x3::rule<class header2a_class, ast_tagged_node> const Header2A = "Header2A";
+x3::rule<class header3a_class, ast_tagged_node> const Header3A = "Header3A";
+x3::rule<class header4a_class, ast_tagged_node> const Header4A = "Header4A";
+x3::rule<class header5a_class, ast_tagged_node> const Header5A = "Header5A";
+x3::rule<class header6a_class, ast_tagged_node> const Header6A = "Header6A";
+
+x3::rule<class highlight_block_class, ast_highlight> const HighlightBlock = "HighlightBlock";
+
+x3::rule<class paragraph_class, ast_tagged_node> const Paragraph = "Paragraph";
+x3::rule<class paragraph_block_class, ast_nodelist> const ParagraphBlock = "ParagraphBlock";
+x3::rule<class inline_list_class, ast_nodelist> const InlineList = "InlineList";
+x3::rule<class block_class, ast_node> const Block = "Block";
+x3::rule<class block_list_class, ast_nodelist> const BlockList = "BlockList";
+x3::rule<class start_class, ast_node> const Start = "Start";
+
+// *** semantic actions
+
+//! append a fixed text to the rule's string
+auto append(const char* text)
+{
+    return [text](auto& ctx) { x3::_val(ctx) += text; };
+}
+
+auto const append_char = [](auto& ctx) { x3::_val(ctx) += x3::_attr(ctx); };
+
+auto const make_link = [](auto& ctx) {
+    using boost::fusion::at_c;
+    x3::_val(ctx) = ast_html_node(
+        html_tag_id::markdown_a, at_c<1>(x3::_attr(ctx)), at_c<0>(x3::_attr(ctx)));
+};
+
+auto const make_image = [](auto& ctx) {
+    using boost::fusion::at_c;
+    x3::_val(ctx) = ast_html_selfnode(
+        html_tag_id::markdown_img, at_c<0>(x3::_attr(ctx)), at_c<1>(x3::_attr(ctx)));
+};
+
+auto const make_download = [](auto& ctx) {
+    x3::_val(ctx) = ast_html_selfnode(
+        html_tag_id::markdown_download, x3::_attr(ctx));
+};
+
+auto const make_self_link = [](auto& ctx) {
+    const std::string& url = x3::_attr(ctx);
+    x3::_val(ctx) = "<a href=\"" + url + "\">" + url + "</a>";
+};
+
+auto const make_anchor = [](auto& ctx) {
+    x3::_val(ctx) = "<a id=\"" + x3::_attr(ctx) + "\"></a>";
+};
+
+// HeaderA is a list of the anchor and the header's inline nodes
+auto const make_header_a = [](auto& ctx) {
+    using boost::fusion::at_c;
+    ast_nodelist& list = x3::_val(ctx);
+    list.push_back(std::move(at_c<0>(x3::_attr(ctx))));
+    for (ast_node& n : at_c<1>(x3::_attr(ctx)))
+        list.push_back(std::move(n));
+};
+
+// *** General Base Character Parsers
+
+auto const HtmlText_def = html_text_x3();
+
+auto const SpecialChar_def =
+    char_("*`#[])!")[append_char]
+    | lit("\\\\")[append("\\")]
+    | lit("\\\"")[append("\"")]
+    | lit("\\&")[append("&")]
+    | lit("\\*")[append("*")]
+    | lit("\\#")[append("#")]
+    | lit("\\`")[append("`")]
+    | lit("\\[")[append("[")]
+    | lit("\\<")[append("&lt;")]
+    | (lit('%') >> !lit('%'))[append("%")];
+
+auto const BlankLine_def = *blank >> eol;
+
+// *** Inline Blocks with Special Formatting
+
+auto const Inline_def =
+    Comment | VerbatimInline | Code | Strong | Emph | SelfLink | MarkDownload
+    | MarkLink | MarkImage | HtmlText | SpecialChar;
+
+auto const Comment_def = "<%#" >> *(!lit("%>") >> char_) >> "%>";
+
+auto const CommentBlock_def =
+    "<%#" >> *(!lit("%>") >> char_) >> "%>" >> omit[*eol];
+
+auto const Code_def = '`' >> x3::attr(html_tag_id::code) >> CodeBlock >> '`';
+auto const CodeBlock_def = +(!lit('`') >> Inline);
+
+auto const Emph_def = '*' >> x3::attr(html_tag_id::i) >> EmphBlock >> '*';
+auto const EmphBlock_def = +(!lit('*') >> Inline);
+
+auto const Strong_def = "**" >> x3::attr(html_tag_id::b) >> StrongBlock >> "**";
+auto const StrongBlock_def = +(!lit("**") >> Inline);
+
+auto const MarkLink_def =
+    ('[' >> MarkLinkText >> "](" >> MarkLinkRef >> ')')[make_link];
+
+auto const MarkLinkText_def = +(!lit(']') >> Inline);
+auto const MarkLinkRef_def = x3::attr(std::string("href")) >> MarkLinkRefList;
+auto const MarkLinkRefList_def = +(!lit(')') >> Inline);
+
+auto const MarkImage_def =
+    ("![" >> MarkImageAlt >> "](" >> MarkImageSrc >> ')')[make_image];
+
+auto const MarkImageAlt_def = x3::attr(std::string("alt")) >> MarkLinkText;
+auto const MarkImageSrc_def = x3::attr(std::string("src")) >> MarkLinkRefList;
+
+auto const MarkDownload_def = "[[" >> MarkDownloadRef[make_download] >> "]]";
+
+auto const MarkDownloadRef_def =
+    x3::attr(std::string("href")) >> MarkDownloadHref;
+auto const MarkDownloadHref_def = +~char_(']');
+
+auto const HttpLink_def = x3::string("http") >> +~char_('>');
+
+auto const SelfLink_def =
+    &lit("<http") >> '<' >> HttpLink[make_self_link] >> '>';
+
+auto const VerbatimBlock_def =
+    "<%$" >> omit[eol] >> *(!lit("%>") >> char_) >> "%>" >> omit[eol];
+
+auto const VerbatimInline_def = "<%$" >> *(!lit("%>") >> char_) >> "%>";
+
+// *** Paragraph Blocks: Headers
+
+auto const Header6_def = "###### " >> x3::attr(html_tag_id::h6) >> InlineList;
+auto const Header5_def = "##### " >> x3::attr(html_tag_id::h5) >> InlineList;
+auto const Header4_def = "#### " >> x3::attr(html_tag_id::h4) >> InlineList;
+auto const Header3_def = "### " >> x3::attr(html_tag_id::h3) >> InlineList;
+auto const Header2_def = "## " >> x3::attr(html_tag_id::h2) >> InlineList;
+auto const Header1_def = "# " >> x3::attr(html_tag_id::h1) >> InlineList;
+
+auto const HeaderAnchor_def = (+~char_(')'))[make_anchor];
+
+auto const HeaderA_def = (HeaderAnchor >> lit(") ") >> InlineList)[make_header_a];
+
+auto const Header6A_def = "######(" >> x3::attr(html_tag_id::h6) >> HeaderA;
+auto const Header5A_def = "#####(" >> x3::attr(html_tag_id::h5) >> HeaderA;
+auto const Header4A_def = "####(" >> x3::attr(html_tag_id::h4) >> HeaderA;
+auto const Header3A_def = "###(" >> x3::attr(html_tag_id::h3) >> HeaderA;
+auto const Header2A_def = "##(" >> x3::attr(html_tag_id::h2) >> HeaderA;
+auto const Header1A_def = "#(" >> x3::attr(html_tag_id::h1) >> HeaderA;
+
+auto const Header_def =
+    &lit('#') >> (Header6A | Header5A | Header4A | Header3A | Header2A | Header1A
+                  | Header6 | Header5 | Header4 | Header3 | Header2 | Header1);
+
+// *** Source Highlighting Code Blocks
+
+auto const HighlightBlock_def =
+    "```" >> omit[*blank] >> *print >> omit[eol]
+          >> *(!(eol >> "```") >> char_)
+          >> omit[eol] >> "```" >> omit[*blank >> eol];
+
+// *** Paragraph Blocks: Paragraphs and Plain
+
+auto const Paragraph_def =
+    x3::attr(html_tag_id::p) >> ParagraphBlock >> omit[+(eol | blank >> eoi)];
+auto const ParagraphBlock_def = InlineList;
+
+auto const InlineList_def = +Inline;
+
+auto const Block_def =
+    omit[*BlankLine] >> (CommentBlock | VerbatimBlock | HighlightBlock | Header
+                         | Paragraph | InlineList);
+
+auto const BlockList_def = *Block;
+
+auto const Start_def = BlockList;
+
+BOOST_SPIRIT_DEFINE(
+    HtmlText, SpecialChar, BlankLine, Inline, Comment, CommentBlock,
+    Code, Emph, Strong, CodeBlock, EmphBlock, StrongBlock,
+    MarkLink, MarkLinkText, MarkLinkRef, MarkLinkRefList,
+    MarkImage, MarkImageAlt, MarkImageSrc,
+    MarkDownload, MarkDownloadRef, MarkDownloadHref, HttpLink, SelfLink,
+    VerbatimBlock, VerbatimInline,
+    Header, Header1, Header2, Header3, Header4, Header5, Header6,
+    HeaderA, HeaderAnchor,
+    Header1A, Header2A, Header3A, Header4A, Header5A, Header6A,
+    HighlightBlock, Paragraph, ParagraphBlock, InlineList, Block, BlockList,
+    Start);
+
+} // namespace markup_grammar
+
+/******************************************************************************/
+// Parse with either parser like parse_markup_quiet() of spirit7_html.cpp: the
+// grammar has no skipper, the input is only pre- and post-skipped.
+
+bool parse_markup_x3(const std::string& input, ast_node& ast)
+{
+    ParseStatsScope stats("parse_markup_x3", input.size());
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    bool r = x3::phrase_parse(begin, end, x3::lexeme[markup_grammar::Start],
+                              x3::space, ast);
+    return r && begin == end;
+}
+
+bool parse_markup_qi(const std::string& input, const MyMarkupParser<>& p,
+                     ast_node& ast)
+{
+    ParseStatsScope stats("parse_markup_qi", input.size());
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    bool r = qi::phrase_parse(begin, end, p, qi::space, ast);
+    return r && begin == end;
+}
+
+//! structural comparison of two ASTs. Only the node types which the X3 rules
+//! produce are compared, all others are reported as different.
+struct ast_equal : boost::static_visitor<bool>
+{
+    static bool same(const ast_node& a, const ast_node& b)
+    {
+        return boost::apply_visitor(ast_equal(), a, b);
+    }
+
+    template <typename A, typename B>
+    bool operator () (const A&, const B&) const { return false; }
+
+    bool operator () (const std::string& a, const std::string& b) const
+    {
+        return a == b;
+    }
+
+    bool operator () (const ast_comment& a, const ast_comment& b) const
+    {
+        return a.text() == b.text();
+    }
+
+    bool operator () (const ast_nodelist& a, const ast_nodelist& b) const
+    {
+        return a.size() == b.size() &&
+               std::equal(a.begin(), a.end(), b.begin(), same);
+    }
+
+    bool operator () (const ast_highlight& a, const ast_highlight& b) const
+    {
+        return a.language == b.language && a.content.text() == b.content.text();
+    }
+
+    bool operator () (const ast_tagged_node& a, const ast_tagged_node& b) const
+    {
+        return a.tag == b.tag && same(a.subtree, b.subtree);
+    }
+
+    bool operator () (const ast_html_node& a, const ast_html_node& b) const
+    {
+        return a.tag == b.tag && same_attrs(a.attrlist, b.attrlist) &&
+               same(a.subtree, b.subtree);
+    }
+
+    bool operator () (const ast_html_selfnode& a,
+                      const ast_html_selfnode& b) const
+    {
+        return a.tag == b.tag && same_attrs(a.attrlist, b.attrlist);
+    }
+
+    static bool same_attrs(const ast_html_attrlist& a,
+                           const ast_html_attrlist& b)
+    {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].name != b[i].name || !same(a[i].value, b[i].value))
+                return false;
+        }
+        return true;
+    }
+};
+
+//! number of nodes of an AST, the checksum of the benchmark
+struct ast_count : boost::static_visitor<size_t>
+{
+    template <typename Node>
+    size_t operator () (const Node&) const { return 1; }
+
+    size_t operator () (const ast_nodelist& list) const
+    {
+        size_t n = 1;
+        for (const ast_node& node : list)
+            n += boost::apply_visitor(*this, node);
+        return n;
+    }
+
+    size_t operator () (const ast_tagged_node& node) const
+    {
+        return 1 + boost::apply_visitor(*this, node.subtree);
+    }
+
+    size_t operator () (const ast_html_node& node) const
+    {
+        return 1 + boost::apply_visitor(*this, node.subtree);
+    }
+};
+
+void test1_compare(const std::string& input, const std::string& name)
+{
+    const MyMarkupParser<> p;
+    ast_node qi_ast, x3_ast;
+    bool qi_ok = parse_markup_qi(input, p, qi_ast);
+    bool x3_ok = parse_markup_x3(input, x3_ast);
+
+    std::cout << name << ": qi " << (qi_ok ? "parsed" : "FAILED")
+              << ", x3 " << (x3_ok ? "parsed" : "FAILED") << ", "
+              << boost::apply_visitor(ast_count(), x3_ast) << " nodes, ASTs "
+              << (ast_equal::same(qi_ast, x3_ast) ? "equal" : "DIFFER")
+              << std::endl;
+}
+
+/******************************************************************************/
+// Benchmark of the Qi and X3 parsers on generated documents of paragraphs and
+// headers with inline formatting, links and entities. The RESULT lines are
+// those of benchmark.hpp, "terms" are the blocks of the document and the
+// checksum is the number of AST nodes.
+
+//! a random word, sometimes with inline formatting
+std::string GenerateInline(std::mt19937& rng)
+{
+    static const char* words[] = {
+        "parser", "grammar", "rule", "Spirit", "X3", "AST", "text", "node",
+        "input", "markup", "fast", "and", "the", "of", "a", "it's",
+    };
+    std::string w = words[rng() % (sizeof(words) / sizeof(*words))];
+    switch (rng() % 16) {
+    case 0: return "**" + w + "**";
+    case 1: return "*" + w + "*";
+    case 2: return "`" + w + "`";
+    case 3: return "[" + w + "](http://example.com/" + w + ")";
+    case 4: return "![" + w + "](" + w + ".png)";
+    case 5: return w + " & " + w;
+    default: return w;
+    }
+}
+
+//! a document with the given number of blocks
+std::string GenerateMarkup(std::mt19937& rng, size_t blocks)
+{
+    std::string out;
+    for (size_t b = 0; b < blocks; ++b) {
+        if (rng() % 8 == 0)
+            out += std::string(1 + rng() % 3, '#') + " ";
+        size_t words = 5 + rng() % 40;
+        for (size_t i = 0; i < words; ++i) {
+            if (i != 0) out += (rng() % 10 == 0 ? "\n" : " ");
+            out += GenerateInline(rng);
+        }
+        out += "\n\n";
+    }
+    return out;
+}
+
+void test2_benchmark()
+{
+    // the Qi grammar is constructed at runtime, the X3 parser is constant
+    auto t1 = std::chrono::steady_clock::now();
+    const MyMarkupParser<> p;
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "RESULT"
+              << " benchmark=markup_grammar_construct"
+              << " variant=spirit9_qi"
+              << " time=" << std::chrono::duration<double>(t2 - t1).count()
+              << std::endl;
+
+    std::mt19937 rng(42);
+    for (size_t blocks = 10; blocks <= 10000; blocks *= 10) {
+        std::string input = GenerateMarkup(rng, blocks);
+        size_t reps = std::max<size_t>(1, 20000 / blocks);
+
+        ast_node qi_ast, x3_ast;
+        if (!parse_markup_qi(input, p, qi_ast) ||
+            !parse_markup_x3(input, x3_ast) ||
+            !ast_equal::same(qi_ast, x3_ast)) {
+            std::cout << "!!! Qi and X3 ASTs differ" << std::endl;
+            return;
+        }
+
+        RunBenchmark(
+            "markup_parse", "spirit9_qi", input, blocks, 0, reps,
+            [&](const std::string& input) {
+                ast_node ast;
+                parse_markup_qi(input, p, ast);
+                return boost::apply_visitor(ast_count(), ast);
+            });
+        RunBenchmark(
+            "markup_parse", "spirit9_x3", input, blocks, 0, reps,
+            [&](const std::string& input) {
+                ast_node ast;
+                parse_markup_x3(input, ast);
+                return boost::apply_visitor(ast_count(), ast);
+            });
+    }
+    std::cout << "RESULT"
+              << " benchmark=peak_rss"
+              << " program=spirit9_x3_markup"
+              << " peak_rss_kib=" << PeakRSS()
+              << std::endl;
+}
+
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        test2_benchmark();
+        return 0;
+    }
+
+    if (argc >= 2) {
+        std::ifstream in(argv[1]);
+        std::string input((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        test1_compare(input, argv[1]);
+    }
+    else {
+        std::cout << "Reading stdin" << std::endl;
+        std::string input((std::istreambuf_iterator<char>(std::cin)),
+                          std::istreambuf_iterator<char>());
+        test1_compare(input, "stdin");
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
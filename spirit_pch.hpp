@@ -0,0 +1,14 @@
+// Precompiled header of the Boost Spirit Qi headers used by all examples. The
+// Makefile compiles it to spirit_pch.hpp.gch and force-includes it into each
+// spirit*.cpp with "-include spirit_pch.hpp", which takes most of the parsing
+// of Boost headers out of each compile.
+
+#ifndef SPIRIT_PCH_HEADER
+#define SPIRIT_PCH_HEADER
+
+#include <boost/spirit/include/qi.hpp>
+#include <boost/spirit/include/phoenix.hpp>
+#include <boost/variant/recursive_variant.hpp>
+#include <boost/fusion/include/adapt_struct.hpp>
+
+#endif // !SPIRIT_PCH_HEADER